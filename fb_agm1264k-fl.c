@@ -20,6 +20,8 @@
 #include <linux/gpio.h>
 #include <linux/delay.h>
 #include <linux/slab.h>
+#include <linux/gpio/consumer.h>
+#include <linux/ktime.h>
 
 #include "fbtft.h"
 
@@ -41,6 +43,23 @@
 #define CS0			gpio.aux[0]
 #define CS1			gpio.aux[1]
 
+/* KS0108 write cycle timing (ns) */
+#define KS0108_TAS		140	/* address setup */
+#define KS0108_PWEH		450	/* E high pulse width */
+#define KS0108_PWEL		450	/* E low pulse width */
+#define KS0108_TCYC		1000	/* E cycle time */
+#define KS0108_CALIBRATE	64	/* E toggles used to time gpio writes */
+
+#define PAGES			(HEIGHT / 8)
+
+struct agm1264k_fl_par {
+	unsigned e_high_ns;
+	unsigned e_low_ns;
+	/* what each controller half shows, page by page */
+	u8 shadow[2][PAGES][WIDTH];
+	bool shadow_valid[2][PAGES];
+	signed short *gray;
+};
 
 /* diffusing error ("Floyd-Steinberg") */
 #define DIFFUSING_MATRIX_WIDTH	2
@@ -52,6 +71,27 @@ diffusing_matrix[DIFFUSING_MATRIX_WIDTH][DIFFUSING_MATRIX_HEIGHT] = {
 	{3, 2},
 };
 
+enum {
+	DITHER_THRESHOLD,
+	DITHER_ORDERED,
+	DITHER_DIFFUSING,
+};
+
+static unsigned dither = DITHER_DIFFUSING;
+module_param(dither, uint, 0);
+MODULE_PARM_DESC(dither,
+	"0=threshold, 1=ordered (Bayer 4x4), 2=Floyd-Steinberg (default: 2)");
+
+static const u8 bayer_matrix[4][4] = {
+	{0, 8, 2, 10},
+	{12, 4, 14, 6},
+	{3, 11, 1, 9},
+	{15, 7, 13, 5},
+};
+
+/* (299 * r + 587 * g + 114 * b) / 200 split per channel, in 16.16 */
+static u32 gray_lut_r[32], gray_lut_g[64], gray_lut_b[32];
+
 static const unsigned char gamma_correction_table[] = {
 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 1, 1, 1, 1,
 1, 1, 2, 2, 2, 2, 2, 2, 2, 3, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 6,
@@ -71,13 +111,76 @@ static const unsigned char gamma_correction_table[] = {
 251, 253, 255
 };
 
+/*
+ * Subtract the time a gpio write takes from the datasheet E pulse widths,
+ * so the pulses are only as long as the controller needs. E low is then
+ * stretched so a whole cycle, with both E writes, still takes tCYC. The
+ * data bus writes between the pulses only make the cycle longer.
+ */
+static void calibrate_e_pulse(struct fbtft_par *par)
+{
+	struct agm1264k_fl_par *priv = par->extra;
+	ktime_t start;
+	unsigned ns, high;
+	int i;
+
+	/* deselect both halves, E is ignored then */
+	gpio_set_value(par->CS0, 1);
+	gpio_set_value(par->CS1, 1);
+
+	start = ktime_get();
+	for (i = 0; i < KS0108_CALIBRATE; i++)
+		gpiod_set_raw_value(par->pbus.wr, !(i & 1));
+	ns = ktime_to_ns(ktime_sub(ktime_get(), start)) / KS0108_CALIBRATE;
+
+	priv->e_high_ns = ns < KS0108_PWEH ? KS0108_PWEH - ns : 0;
+	priv->e_low_ns = ns < KS0108_PWEL ? KS0108_PWEL - ns : 0;
+	high = ns + priv->e_high_ns;
+	if (high + ns + priv->e_low_ns < KS0108_TCYC)
+		priv->e_low_ns = KS0108_TCYC - high - ns;
+
+	fbtft_par_dbg(DEBUG_INIT_DISPLAY, par,
+		"gpio write %uns, E high %uns, E low %uns\n",
+		ns, priv->e_high_ns, priv->e_low_ns);
+}
+
+static void init_gray_lut(void)
+{
+	int i;
+
+	for (i = 0; i < 32; i++) {
+		gray_lut_r[i] = (299u * i << 16) / 200;
+		gray_lut_b[i] = (114u * i << 16) / 200;
+	}
+	for (i = 0; i < 64; i++)
+		gray_lut_g[i] = (587u * i << 16) / 200;
+}
+
 static int init_display(struct fbtft_par *par)
 {
+	struct agm1264k_fl_par *priv = par->extra;
 	u8 i;
 
 	fbtft_par_dbg(DEBUG_INIT_DISPLAY, par, "%s()\n", __func__);
 
+	if (!priv) {
+		priv = devm_kzalloc(par->info->device, sizeof(*priv),
+								GFP_KERNEL);
+		if (!priv)
+			return -ENOMEM;
+		/* RGB565 -> grayscale16 -> Ditherd image 1bpp */
+		priv->gray = devm_kzalloc(par->info->device,
+				par->info->var.xres * par->info->var.yres *
+				sizeof(signed short), GFP_KERNEL);
+		if (!priv->gray)
+			return -ENOMEM;
+		par->extra = priv;
+		init_gray_lut();
+	}
+
 	par->fbtftops.reset(par);
+	calibrate_e_pulse(par);
+	memset(priv->shadow_valid, 0, sizeof(priv->shadow_valid));
 
 	for (i = 0; i < 2; ++i) {
 		write_reg(par, i, 0x3f); /* display on */
@@ -255,71 +358,87 @@ static void
 construct_line_bitmap(struct fbtft_par *par, u8 *dest, signed short *src,
 						int xs, int xe, int y)
 {
-	int x, i;
-
-	for (x = xs; x < xe; ++x) {
-		u8 res = 0;
-
-		for (i = 0; i < 8; i++)
-			if (src[(y * 8 + i) * par->info->var.xres + x])
-				res |= 1 << i;
+	int xres = par->info->var.xres;
 #ifdef NEGATIVE
-		*dest++ = res;
+	bool invert = false;
 #else
-		*dest++ = ~res;
+	bool invert = true;
 #endif
-	}
+
+	/* dithered pixels are BLACK or WHITE, never negative */
+	fbtft_pack_page(dest, 1, (u16 *)&src[y * 8 * xres + xs], xres,
+			xe - xs, BLACK, invert);
 }
 
-static int write_vmem(struct fbtft_par *par, size_t offset, size_t len)
+/*
+ * Build one page of one controller half and send the columns that differ
+ * from what the controller already shows.
+ */
+static int write_page(struct fbtft_par *par, int half, int page,
+						signed short *convert_buf)
 {
-	u16 *vmem16 = (u16 *)par->info->screen_base;
+	struct agm1264k_fl_par *priv = par->extra;
+	u8 *shadow = priv->shadow[half][page];
 	u8 *buf = par->txbuf.buf;
-	int x, y;
-	int ret = 0;
+	int first, last, ret;
+
+	construct_line_bitmap(par, buf, convert_buf, half * WIDTH,
+						(half + 1) * WIDTH, page);
+
+	first = 0;
+	last = WIDTH - 1;
+	if (priv->shadow_valid[half][page]) {
+		while (first < WIDTH && buf[first] == shadow[first])
+			first++;
+		if (first == WIDTH)
+			return 0;
+		while (buf[last] == shadow[last])
+			last--;
+	}
+	/* set addr */
+	write_reg(par, half, (1 << 6) | (u8)first);
+	write_reg(par, half, (0x17 << 3) | (u8)page);
+
+	/* write bitmap */
+	gpio_set_value(par->RS, 1); /* RS->1 (data mode) */
+	ret = par->fbtftops.write(par, buf + first, last - first + 1);
+	if (ret < 0) {
+		priv->shadow_valid[half][page] = false;
+		return ret;
+	}
 
-	/* buffer to convert RGB565 -> grayscale16 -> Ditherd image 1bpp */
-	signed short *convert_buf = kmalloc(par->info->var.xres *
-		par->info->var.yres * sizeof(signed short), GFP_NOIO);
+	memcpy(shadow + first, buf + first, last - first + 1);
+	priv->shadow_valid[half][page] = true;
 
-	fbtft_par_dbg(DEBUG_WRITE_VMEM, par, "%s()\n", __func__);
+	return 0;
+}
 
-	/* converting to grayscale16 */
-	for (x = 0; x < par->info->var.xres; ++x)
-		for (y = 0; y < par->info->var.yres; ++y) {
-			u16 pixel = vmem16[y *  par->info->var.xres + x];
-			u16 b = pixel & 0x1f;
-			u16 g = (pixel & (0x3f << 5)) >> 5;
-			u16 r = (pixel & (0x1f << (5 + 6))) >> (5 + 6);
-
-			pixel = (299 * r + 587 * g + 114 * b) / 200;
-			if (pixel > 255)
-				pixel = 255;
-
-			/* gamma-correction by table */
-			convert_buf[y *  par->info->var.xres + x] =
-				(signed short)gamma_correction_table[pixel];
-		}
+/*
+ * Error diffusion, rows y0..y1-1. The error is not carried past y1,
+ * those rows are converted again before they are dithered.
+ */
+static void dither_rows_diffusing(struct fbtft_par *par, signed short *gray,
+							int y0, int y1)
+{
+	int xres = par->info->var.xres;
+	int x, y, i, j;
 
-	/* Image Dithering */
-	for (x = 0; x < par->info->var.xres; ++x)
-		for (y = 0; y < par->info->var.yres; ++y) {
-			signed short pixel =
-				convert_buf[y *  par->info->var.xres + x];
+	for (y = y0; y < y1; ++y)
+		for (x = 0; x < xres; ++x) {
+			signed short pixel = gray[y * xres + x];
 			signed short error_b = pixel - BLACK;
 			signed short error_w = pixel - WHITE;
 			signed short error;
-			u16 i, j;
 
 			/* what color close? */
 			if (abs(error_b) >= abs(error_w)) {
 				/* white */
 				error = error_w;
-				pixel = 0xff;
+				pixel = WHITE;
 			} else {
 				/* black */
 				error = error_b;
-				pixel = 0;
+				pixel = BLACK;
 			}
 
 			error /= 8;
@@ -332,13 +451,9 @@ static int write_vmem(struct fbtft_par *par, size_t offset, size_t len)
 					signed char coeff;
 
 					/* skip pixels out of zone */
-					if (x + i < 0 ||
-						x + i >= par->info->var.xres
-						|| y + j >= par->info->var.yres)
+					if (x + i >= xres || y + j >= y1)
 						continue;
-					write_pos = &convert_buf[
-						(y + j) * par->info->var.xres +
-						x + i];
+					write_pos = &gray[(y + j) * xres + x + i];
 					coeff = diffusing_matrix[i][j];
 					if (coeff == -1)
 						/* pixel itself */
@@ -355,54 +470,82 @@ static int write_vmem(struct fbtft_par *par, size_t offset, size_t len)
 					}
 				}
 		}
+}
 
-	 /* 1 string = 2 pages */
-	 for (y = addr_win.ys_page; y <= addr_win.ye_page; ++y) {
-		/* left half of display */
-		if (addr_win.xs < par->info->var.xres / 2) {
-			construct_line_bitmap(par, buf, convert_buf,
-				addr_win.xs, par->info->var.xres / 2, y);
+/* RGB565 -> gamma corrected gray, rows y0..y1-1 */
+static void convert_rows(struct fbtft_par *par, signed short *gray,
+							int y0, int y1)
+{
+	u16 *vmem16 = (u16 *)par->vmem;
+	int xres = par->info->var.xres;
+	int x, y;
 
-			len = par->info->var.xres / 2 - addr_win.xs;
+	for (y = y0; y < y1; ++y) {
+		u16 *src = &vmem16[y * xres];
+		signed short *dst = &gray[y * xres];
 
-			/* select left side (sc0)
-			 * set addr
-			 */
-			write_reg(par, 0x00, (1 << 6) | (u8)addr_win.xs);
-			write_reg(par, 0x00, (0x17 << 3) | (u8)y);
+		for (x = 0; x < xres; ++x) {
+			u16 pixel = src[x];
 
-			/* write bitmap */
-			gpio_set_value(par->RS, 1); /* RS->1 (data mode) */
-			ret = par->fbtftops.write(par, buf, len);
-			if (ret < 0)
-				dev_err(par->info->device,
-					"%s: write failed and returned: %d\n",
-					__func__, ret);
+			dst[x] = gamma_correction_table[(gray_lut_r[pixel >> 11] +
+				gray_lut_g[(pixel >> 5) & 0x3f] +
+				gray_lut_b[pixel & 0x1f]) >> 16];
 		}
-		/* right half of display */
-		if (addr_win.xe >= par->info->var.xres / 2) {
-			construct_line_bitmap(par, buf,
-				convert_buf, par->info->var.xres / 2,
-				addr_win.xe + 1, y);
-
-			len = addr_win.xe + 1 - par->info->var.xres / 2;
-
-			/* select right side (sc1)
-			 * set addr
-			 */
-			write_reg(par, 0x01, (1 << 6));
-			write_reg(par, 0x01, (0x17 << 3) | (u8)y);
-
-			/* write bitmap */
-			gpio_set_value(par->RS, 1); /* RS->1 (data mode) */
-			par->fbtftops.write(par, buf, len);
+	}
+}
+
+static void dither_rows(struct fbtft_par *par, signed short *gray,
+							int y0, int y1)
+{
+	int xres = par->info->var.xres;
+	int x, y;
+
+	switch (dither) {
+	case DITHER_THRESHOLD:
+		for (y = y0; y < y1; ++y)
+			for (x = 0; x < xres; ++x)
+				gray[y * xres + x] = gray[y * xres + x] >= 128 ?
+								WHITE : BLACK;
+		break;
+	case DITHER_ORDERED:
+		for (y = y0; y < y1; ++y)
+			for (x = 0; x < xres; ++x)
+				gray[y * xres + x] = gray[y * xres + x] >=
+					bayer_matrix[y & 3][x & 3] * 15 + 8 ?
+								WHITE : BLACK;
+		break;
+	default:
+		dither_rows_diffusing(par, gray, y0, y1);
+		break;
+	}
+}
+
+static int write_vmem(struct fbtft_par *par, size_t offset, size_t len)
+{
+	struct agm1264k_fl_par *priv = par->extra;
+	int y0 = addr_win.ys_page * 8;
+	int y1 = (addr_win.ye_page + 1) * 8;
+	int y, half;
+	int ret = 0;
+
+	fbtft_par_dbg(DEBUG_WRITE_VMEM, par, "%s()\n", __func__);
+
+	if (y1 > par->info->var.yres)
+		y1 = par->info->var.yres;
+
+	/* only the pages covered by the update window */
+	convert_rows(par, priv->gray, y0, y1);
+	dither_rows(par, priv->gray, y0, y1);
+
+	for (y = addr_win.ys_page; y <= addr_win.ye_page; ++y) {
+		for (half = 0; half < 2; half++) {
+			ret = write_page(par, half, y, priv->gray);
 			if (ret < 0)
 				dev_err(par->info->device,
 					"%s: write failed and returned: %d\n",
 					__func__, ret);
 		}
 	}
-	kfree(convert_buf);
 
 	gpio_set_value(par->CS0, 1);
 	gpio_set_value(par->CS1, 1);
@@ -412,26 +555,24 @@ static int write_vmem(struct fbtft_par *par, size_t offset, size_t len)
 
 static int write(struct fbtft_par *par, void *buf, size_t len)
 {
+	struct agm1264k_fl_par *priv = par->extra;
+	u8 *data = buf;
+
 	fbtft_par_dbg_hex(DEBUG_WRITE, par, par->info->device, u8, buf, len,
 		"%s(len=%d): ", __func__, len);
 
 	gpio_set_value(par->RW, 0); /* set write mode */
-
+	ndelay(KS0108_TAS);
 
 	while (len--) {
-		u8 i, data;
-
-		data = *(u8 *) buf++;
-
-		/* set data bus */
-		for (i = 0; i < 8; ++i)
-			gpio_set_value(par->gpio.db[i], data & (1 << i));
+		/* set data bus, E is low so the controller ignores it */
+		fbtft_gpio_bus_set(par, *data++, 0x00FF);
 		/* set E */
-		gpio_set_value(par->EPIN, 1);
-		udelay(5);
+		gpiod_set_raw_value(par->pbus.wr, 1);
+		ndelay(priv->e_high_ns);
 		/* unset E - write */
-		gpio_set_value(par->EPIN, 0);
-		udelay(1);
+		gpiod_set_raw_value(par->pbus.wr, 0);
+		ndelay(priv->e_low_ns);
 	}
 
 	return 0;
@@ -144,6 +144,7 @@ static struct fbtft_display display = {
 	.regwidth = 8,
 	.width = 128,
 	.height = 160,
+	.col_window = true,
 	.gamma_num = 1,
 	.gamma_len = 19,
 	.gamma = DEFAULT_GAMMA,
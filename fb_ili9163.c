@@ -262,6 +262,7 @@ static struct fbtft_display display = {
 	.regwidth = 8,
 	.width = WIDTH,
 	.height = HEIGHT,
+	.col_window = true,
 	.bpp = BPP,
 	.fps = FPS,
 #ifdef GAMMA_ADJ
@@ -156,6 +156,7 @@ static struct fbtft_display display = {
 	.regwidth = 8,
 	.width = WIDTH,
 	.height = HEIGHT,
+	.col_window = true,
 	.txbuflen = TXBUFLEN,
 	.gamma_num = 2,
 	.gamma_len = 15,
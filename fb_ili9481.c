@@ -99,6 +99,7 @@ static struct fbtft_display display = {
 	.regwidth = 8,
 	.width = WIDTH,
 	.height = HEIGHT,
+	.col_window = true,
 	.init_sequence = default_init_sequence,
 	.fbtftops = {
 		.set_addr_win = set_addr_win,
@@ -110,22 +110,15 @@ static void set_addr_win(struct fbtft_par *par, int xs, int ys, int xe, int ye)
 
 static int write_vmem(struct fbtft_par *par, size_t offset, size_t len)
 {
-	u16 *vmem16 = (u16 *)par->info->screen_base;
+	u16 *vmem16 = (u16 *)par->vmem;
 	u8 *buf = par->txbuf.buf;
-	int x, y, i;
+	int y;
 	int ret = 0;
 
 	fbtft_par_dbg(DEBUG_WRITE_VMEM, par, "%s()\n", __func__);
 
-	for (x=0;x<84;x++) {
-		for (y=0;y<6;y++) {
-			*buf = 0x00;
-			for (i=0;i<8;i++) {
-				*buf |= (vmem16[(y*8+i)*84+x] ? 1 : 0) << i;
-			}
-			buf++;
-		}
-	}
+	for (y=0;y<6;y++)
+		fbtft_pack_page(buf+y, 6, vmem16+y*8*84, 84, 84, 0, false);
 
 	/* Write data */
 	gpio_set_value(par->gpio.dc, 1);
@@ -39,33 +39,6 @@
 
 #define DRVNAME "fb_ra8875"
 
-static int write_spi(struct fbtft_par *par, void *buf, size_t len)
-{
-	struct spi_transfer t = {
-		.tx_buf = buf,
-		.len = len,
-		.speed_hz = 1000000,
-	};
-	struct spi_message m;
-
-	fbtft_par_dbg_hex(DEBUG_WRITE, par, par->info->device, u8, buf, len,
-		"%s(len=%d): ", __func__, len);
-
-	if (!par->spi) {
-		dev_err(par->info->device,
-			"%s: par->spi is unexpectedly NULL\n", __func__);
-		return -1;
-	}
-
-	spi_message_init(&m);
-	if (par->txbuf.dma && buf == par->txbuf.buf) {
-		t.tx_dma = par->txbuf.dma;
-		m.is_dma_mapped = 1;
-	}
-	spi_message_add_tail(&t, &m);
-	return spi_sync(par->spi, &m);
-}
-
 static int init_display(struct fbtft_par *par)
 {
 	gpio_set_value(par->gpio.dc, 1);
@@ -220,9 +193,6 @@ static void write_reg8_bus8(struct fbtft_par *par, int len, ...)
 	int i, ret;
 	u8 *buf = (u8 *)par->buf;
 
-	/* slow down spi-speed for writing registers */
-	par->fbtftops.write = write_spi;
-
 	if (unlikely(par->debug & DEBUG_WRITE_REGISTER)) {
 		va_start(args, len);
 		for (i = 0; i < len; i++)
@@ -263,8 +233,6 @@ static void write_reg8_bus8(struct fbtft_par *par, int len, ...)
 	}
 	va_end(args);
 
-	/* restore user spi-speed */
-	par->fbtftops.write = fbtft_write_spi;
 	udelay(100);
 }
 
@@ -275,7 +243,6 @@ static int write_vmem16_bus8(struct fbtft_par *par, size_t offset, size_t len)
 	size_t remain;
 	size_t to_copy;
 	size_t tx_array_size;
-	int i;
 	int ret = 0;
 	size_t startbyte_size = 0;
 
@@ -283,7 +250,7 @@ static int write_vmem16_bus8(struct fbtft_par *par, size_t offset, size_t len)
 		__func__, offset, len);
 
 	remain = len / 2;
-	vmem16 = (u16 *)(par->info->screen_base + offset);
+	vmem16 = (u16 *)(par->vmem + offset);
 	tx_array_size = par->txbuf.len / 2;
 		txbuf16 = (u16 *)(par->txbuf.buf + 1);
 		tx_array_size -= 2;
@@ -295,8 +262,7 @@ static int write_vmem16_bus8(struct fbtft_par *par, size_t offset, size_t len)
 		dev_dbg(par->info->device, "    to_copy=%zu, remain=%zu\n",
 			to_copy, remain - to_copy);
 
-		for (i = 0; i < to_copy; i++)
-			txbuf16[i] = cpu_to_be16(vmem16[i]);
+		fbtft_convert_vmem16(par, txbuf16, vmem16, to_copy);
 
 		vmem16 = vmem16 + to_copy;
 		ret = par->fbtftops.write(par, par->txbuf.buf,
@@ -311,12 +277,14 @@ static int write_vmem16_bus8(struct fbtft_par *par, size_t offset, size_t len)
 
 static struct fbtft_display display = {
 	.regwidth = 8,
+	.big_endian = true,
+	/* register writes are not reliable at higher speeds */
+	.reg_speed_hz = 1000000,
 	.fbtftops = {
 		.init_display = init_display,
 		.set_addr_win = set_addr_win,
 		.write_register = write_reg8_bus8,
 		.write_vmem = write_vmem16_bus8,
-		.write = write_spi,
 	},
 };
 FBTFT_REGISTER_DRIVER(DRVNAME, "raio,ra8875", &display);
@@ -150,6 +150,7 @@ static struct fbtft_display display = {
 	.regwidth = 8,
 	.width = 128,
 	.height = 160,
+	.col_window = true,
 	.init_sequence = default_init_sequence,
 	.fbtftops = {
 		.set_addr_win = set_addr_win,
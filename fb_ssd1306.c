@@ -172,21 +172,19 @@ static int set_gamma(struct fbtft_par *par, unsigned long *curves)
 
 static int write_vmem(struct fbtft_par *par, size_t offset, size_t len)
 {
-	u16 *vmem16 = (u16 *)par->info->screen_base;
+	u16 *vmem16 = (u16 *)par->vmem;
 	u8 *buf = par->txbuf.buf;
-	int x, y, i;
+	int xres = par->info->var.xres;
+	int pages = par->info->var.yres/8;
+	int y;
 	int ret = 0;
 
 	fbtft_par_dbg(DEBUG_WRITE_VMEM, par, "%s()\n", __func__);
 
-	for (x = 0; x < par->info->var.xres; x++) {
-		for (y = 0; y < par->info->var.yres/8; y++) {
-			*buf = 0x00;
-			for (i = 0; i < 8; i++)
-				*buf |= (vmem16[(y*8+i)*par->info->var.xres+x] ? 1 : 0) << i;
-			buf++;
-		}
-	}
+	/* vertical addressing: all pages of a column, column by column */
+	for (y = 0; y < pages; y++)
+		fbtft_pack_page(buf + y, pages, vmem16 + y*8*xres, xres, xres,
+								0, false);
 
 	/* Write data */
 	gpio_set_value(par->gpio.dc, 1);
@@ -173,6 +173,7 @@ static struct fbtft_display display = {
 	.regwidth = 8,
 	.width = 128,
 	.height = 160,
+	.col_window = true,
 	.init_sequence = default_init_sequence,
 	.gamma_num = 2,
 	.gamma_len = 16,
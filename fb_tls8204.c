@@ -99,29 +99,21 @@ static void set_addr_win(struct fbtft_par *par, int xs, int ys, int xe, int ye)
 
 static int write_vmem(struct fbtft_par *par, size_t offset, size_t len)
 {
-	u16 *vmem16 = (u16 *)par->info->screen_base;
-	int x, y, i;
+	u16 *vmem16 = (u16 *)par->vmem;
+	int y;
 	int ret = 0;
 
 	fbtft_par_dbg(DEBUG_WRITE_VMEM, par, "%s()\n", __func__);
 
 	for (y = 0; y < HEIGHT/8; y++) {
-		u8 *buf = par->txbuf.buf;
 		/* The display is 102x68 but the LCD is 84x48.  Set
 		   the write pointer at the start of each row. */
 		gpio_set_value(par->gpio.dc, 0);
 		write_reg(par, 0x80 | 0);
 		write_reg(par, 0x40 | y);
 
-		for (x = 0; x < WIDTH; x++) {
-			u8 ch = 0;
-			for (i = 0; i < 8*WIDTH; i += WIDTH) {
-				ch >>= 1;
-				if (vmem16[(y*8*WIDTH)+i+x])
-					ch |= 0x80;
-			}
-			*buf++ = ch;
-		}
+		fbtft_pack_page(par->txbuf.buf, 1, vmem16 + y*8*WIDTH, WIDTH,
+							WIDTH, 0, false);
 		/* Write the row */
 		gpio_set_value(par->gpio.dc, 1);
 		ret = par->fbtftops.write(par, par->txbuf.buf, WIDTH);
@@ -150,21 +150,15 @@ static void set_addr_win(struct fbtft_par *par, int xs, int ys, int xe, int ye)
 
 static int write_vmem(struct fbtft_par *par, size_t offset, size_t len)
 {
-	u16 *vmem16 = (u16 *)par->info->screen_base;
-	u8 *buf = par->txbuf.buf;
-	int x, y, i;
+	u16 *vmem16 = (u16 *)par->vmem;
+	int y;
 	int ret = 0;
 
 	fbtft_par_dbg(DEBUG_WRITE_VMEM, par, "%s()\n", __func__);
 
 	for (y = 0; y < PAGES; y++) {
-		buf = par->txbuf.buf;
-		for (x = 0; x < WIDTH; x++) {
-			*buf = 0x00;
-			for (i = 0; i < 8; i++)
-				*buf |= (vmem16[((y*8*WIDTH)+(i*WIDTH))+x] ? 1 : 0) << i;
-			buf++;
-		}
+		fbtft_pack_page(par->txbuf.buf, 1, vmem16 + y*8*WIDTH, WIDTH,
+							WIDTH, 0, false);
 		/* LCD_PAGE_ADDRESS | ((page) & 0x1F),
 		 (((col)+SHIFT_ADDR_NORMAL) & 0x0F),
 		  LCD_COL_ADDRESS | ((((col)+SHIFT_ADDR_NORMAL)>>4) & 0x0F) */
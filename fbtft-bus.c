@@ -2,6 +2,8 @@
 #include <linux/errno.h>
 #include <linux/gpio.h>
 #include <linux/spi/spi.h>
+#include <linux/string.h>
+#include <asm/unaligned.h>
 #include "fbtft.h"
 
 
@@ -78,7 +80,6 @@ void fbtft_write_reg8_bus9(struct fbtft_par *par, int len, ...)
 {
 	va_list args;
 	int i, ret;
-	int pad = 0;
 	u16 *buf = (u16 *)par->buf;
 
 	if (unlikely(par->debug & DEBUG_WRITE_REGISTER)) {
@@ -92,14 +93,6 @@ void fbtft_write_reg8_bus9(struct fbtft_par *par, int len, ...)
 	if (len <= 0)
 		return;
 
-	if (par->spi && (par->spi->bits_per_word == 8)) {
-		/* we're emulating 9-bit, pad start of buffer with no-ops
-		   (assuming here that zero is a no-op) */
-		pad = (len % 4) ? 4 - (len % 4) : 0;
-		for (i = 0; i < pad; i++)
-			*buf++ = 0x000;
-	}
-
 	va_start(args, len);
 	*buf++ = (u8)va_arg(args, unsigned int);
 	i = len - 1;
@@ -108,7 +101,7 @@ void fbtft_write_reg8_bus9(struct fbtft_par *par, int len, ...)
 		*buf++ |= 0x100; /* dc=1 */
 	}
 	va_end(args);
-	ret = par->fbtftops.write(par, par->buf, (len + pad) * sizeof(u16));
+	ret = par->fbtftops.write(par, par->buf, len * sizeof(u16));
 	if (ret < 0) {
 		dev_err(par->info->device,
 			"%s: write() failed and returned %d\n", __func__, ret);
@@ -120,12 +113,322 @@ EXPORT_SYMBOL(fbtft_write_reg8_bus9);
 
 
 
+/*****************************************************************************
+ *
+ *   Pixel conversion
+ *
+ *****************************************************************************/
+
+/* 0x00FF00FF... in a machine word */
+#define FBTFT_LOW_BYTES		(~0UL / 0xFFFF * 0xFF)
+
+static void fbtft_convert_vmem16_band(struct fbtft_par *par, void *dst,
+					const u16 *src, size_t count)
+{
+#ifdef __LITTLE_ENDIAN
+	const size_t per_word = sizeof(unsigned long) / 2;
+	unsigned long v;
+	u8 *d = dst;
+
+	if (!par->big_endian) {
+		/* one pixel at a time until src is word aligned */
+		while (count && ((unsigned long)src & (sizeof(v) - 1))) {
+			put_unaligned(swab16(*src++), (u16 *)d);
+			d += 2;
+			count--;
+		}
+		while (count >= per_word) {
+			v = *(const unsigned long *)src;
+			v = ((v & FBTFT_LOW_BYTES) << 8) |
+			    ((v >> 8) & FBTFT_LOW_BYTES);
+			put_unaligned(v, (unsigned long *)d);
+			src += per_word;
+			d += sizeof(v);
+			count -= per_word;
+		}
+		while (count--) {
+			put_unaligned(swab16(*src++), (u16 *)d);
+			d += 2;
+		}
+		return;
+	}
+#endif
+	memcpy(dst, src, count * 2);
+}
+
+static void fbtft_convert_band_work(struct work_struct *work)
+{
+	struct fbtft_convert_band *band =
+		container_of(work, struct fbtft_convert_band, work);
+
+	fbtft_convert_vmem16_band(band->par, band->dst, band->src,
+								band->count);
+}
+
+/**
+ * fbtft_convert_init() - Set up parallel pixel conversion
+ * @par: Driver data
+ * @bands: Number of CPUs to use, 1 converts on the calling CPU only
+ */
+void fbtft_convert_init(struct fbtft_par *par, unsigned bands)
+{
+	unsigned i;
+
+	par->convert.bands = clamp_t(unsigned, bands, 1, FBTFT_CONVERT_BANDS);
+	for (i = 0; i < FBTFT_CONVERT_BANDS; i++) {
+		par->convert.band[i].par = par;
+		INIT_WORK(&par->convert.band[i].work, fbtft_convert_band_work);
+	}
+}
+
+/**
+ * fbtft_convert_vmem16() - Copy 16-bit pixels in big endian byte order
+ * @par: Driver data
+ * @dst: Destination buffer, needs no alignment
+ * @src: Video memory
+ * @count: Number of pixels
+ *
+ * Big endian video memory is copied as is. Otherwise the pixels are
+ * byteswapped a machine word at a time.
+ * Large conversions are split into bands, all but the first one are
+ * converted on other CPUs while the caller does the first. Not done for
+ * a realtime update thread, it would wait on normal priority workers.
+ */
+void fbtft_convert_vmem16(struct fbtft_par *par, void *dst, const u16 *src,
+								size_t count)
+{
+	struct fbtft_convert_band *band = par->convert.band;
+	unsigned bands = min_t(size_t, par->convert.bands,
+					count / FBTFT_CONVERT_MIN_BAND);
+	size_t per_band;
+	unsigned i;
+
+	if (bands < 2 || par->worker.rt_priority) {
+		fbtft_convert_vmem16_band(par, dst, src, count);
+		return;
+	}
+
+	/* whole words per band keeps the word loop aligned */
+	per_band = ALIGN(DIV_ROUND_UP(count, bands), sizeof(long));
+	for (i = 1; i < bands && per_band * i < count; i++) {
+		band[i].dst = dst + per_band * i * 2;
+		band[i].src = src + per_band * i;
+		band[i].count = min(per_band, count - per_band * i);
+		queue_work(system_unbound_wq, &band[i].work);
+	}
+	bands = i;
+
+	fbtft_convert_vmem16_band(par, dst, src, per_band);
+
+	for (i = 1; i < bands; i++)
+		flush_work(&band[i].work);
+}
+EXPORT_SYMBOL(fbtft_convert_vmem16);
+
+/* 8 words of 9 bits, MSB first, fill exactly 9 bytes */
+static inline void fbtft_pack9_group(u8 *dst, const u16 *w)
+{
+	dst[0] = w[0] >> 1;
+	dst[1] = w[0] << 7 | w[1] >> 2;
+	dst[2] = w[1] << 6 | w[2] >> 3;
+	dst[3] = w[2] << 5 | w[3] >> 4;
+	dst[4] = w[3] << 4 | w[4] >> 5;
+	dst[5] = w[4] << 3 | w[5] >> 6;
+	dst[6] = w[5] << 2 | w[6] >> 7;
+	dst[7] = w[6] << 1 | w[7] >> 8;
+	dst[8] = w[7];
+}
+
+/**
+ * fbtft_pack9() - Pack 9-bit words into an 8-bit SPI bitstream
+ * @dst: Destination, needs room for whole groups of 9 bytes
+ * @src: Words, bit 8 is the dc bit
+ * @count: Number of words
+ *
+ * A partial last group is padded with zero bits to the next byte. This
+ * is less than one word, which the controller drops when CS goes high.
+ *
+ * Return: Number of bytes to send
+ */
+size_t fbtft_pack9(u8 *dst, const u16 *src, size_t count)
+{
+	u16 w[8];
+	size_t i, n, len = 0;
+
+	while (count) {
+		n = min_t(size_t, count, 8);
+		for (i = 0; i < 8; i++)
+			w[i] = i < n ? src[i] & 0x01FF : 0;
+		fbtft_pack9_group(dst + len, w);
+		len += DIV_ROUND_UP(n * 9, 8);
+		src += n;
+		count -= n;
+	}
+
+	return len;
+}
+EXPORT_SYMBOL(fbtft_pack9);
+
+/**
+ * fbtft_convert_bus9() - Pack 16-bit pixels into an 8-bit SPI bitstream
+ * @par: Driver data
+ * @dst: Destination, needs room for whole groups of 9 bytes
+ * @src: Video memory
+ * @len: Length of video memory in bytes
+ *
+ * Each byte is sent high byte first as a 9-bit word with the dc bit set,
+ * without going through an intermediate buffer of u16 words.
+ *
+ * Return: Number of bytes to send
+ */
+size_t fbtft_convert_bus9(struct fbtft_par *par, u8 *dst, const u8 *src,
+								size_t len)
+{
+#ifdef __LITTLE_ENDIAN
+	unsigned swap = par->big_endian ? 0 : 1;
+#else
+	unsigned swap = 0;
+#endif
+	u16 w[8];
+	size_t i, n, out = 0;
+
+	for (; len >= 8; len -= 8, src += 8, out += 9) {
+		for (i = 0; i < 8; i++)
+			w[i] = 0x0100 | src[i ^ swap];
+		fbtft_pack9_group(dst + out, w);
+	}
+	if (len) {
+		n = len;
+		for (i = 0; i < 8; i++)
+			w[i] = i < n ? 0x0100 | src[i ^ swap] : 0;
+		fbtft_pack9_group(dst + out, w);
+		out += DIV_ROUND_UP(n * 9, 8);
+	}
+
+	return out;
+}
+EXPORT_SYMBOL(fbtft_convert_bus9);
+
+/* Transpose an 8x8 bit matrix, byte i holds row i (Hacker's Delight) */
+static inline u64 fbtft_transpose8x8(u64 x)
+{
+	u64 t;
+
+	t = (x ^ (x >> 7)) & 0x00AA00AA00AA00AAULL;
+	x = x ^ t ^ (t << 7);
+	t = (x ^ (x >> 14)) & 0x0000CCCC0000CCCCULL;
+	x = x ^ t ^ (t << 14);
+	t = (x ^ (x >> 28)) & 0x00000000F0F0F0F0ULL;
+	x = x ^ t ^ (t << 28);
+
+	return x;
+}
+
+/**
+ * fbtft_pack_page() - Pack 8 lines of pixels into page format bytes
+ * @dst: Byte for the first column
+ * @dst_stride: Distance between the bytes of adjacent columns
+ * @src: First pixel of the top line of the page
+ * @src_stride: Pixels per line
+ * @width: Number of columns
+ * @threshold: Pixels above this value are set
+ * @invert: Invert the result
+ *
+ * Monochrome controllers take one byte per column for each 8 line page,
+ * with the top line in bit 0. The lines are read left to right 8 pixels
+ * at a time, and each 8x8 block is turned into column bytes with a bit
+ * matrix transpose.
+ */
+void fbtft_pack_page(u8 *dst, size_t dst_stride, const u16 *src,
+			size_t src_stride, unsigned width, u16 threshold,
+			bool invert)
+{
+	u8 xor = invert ? 0xFF : 0x00;
+	unsigned x, n, r, c;
+	u64 m;
+
+	for (x = 0; x < width; x += 8) {
+		n = min(width - x, 8U);
+		m = 0;
+		for (r = 0; r < 8; r++) {
+			const u16 *line = src + r * src_stride + x;
+			u8 bits = 0;
+
+			for (c = 0; c < n; c++)
+				bits |= (line[c] > threshold) << c;
+			m |= (u64)bits << (r * 8);
+		}
+		m = fbtft_transpose8x8(m);
+		for (c = 0; c < n; c++, dst += dst_stride)
+			*dst = (u8)(m >> (c * 8)) ^ xor;
+	}
+}
+EXPORT_SYMBOL(fbtft_pack_page);
+
+
+
+
 /*****************************************************************************
  *
  *   int (*write_vmem)(struct fbtft_par *par);
  *
  *****************************************************************************/
 
+/*
+ * 16 bit pixel over 8-bit SPI, txbuf is split into FBTFT_TX_SLOTS slots.
+ * One slot is converted while the previous ones are on the wire.
+ */
+static int fbtft_write_vmem16_bus8_pipelined(struct fbtft_par *par,
+						u16 *vmem16, size_t remain)
+{
+	size_t slot_size = (par->txbuf.len / FBTFT_TX_SLOTS) & ~3;
+	size_t startbyte_size = par->startbyte ? 1 : 0;
+	size_t tx_array_size = min(slot_size - startbyte_size,
+					par->txbuf.chunk) / 2;
+	size_t to_copy;
+	unsigned slot = 0;
+	u16 *txbuf16;
+	u8 *buf;
+	int i, err;
+	int ret = 0;
+
+	while (remain) {
+		to_copy = remain > tx_array_size ? tx_array_size : remain;
+		dev_dbg(par->info->device, "    slot=%u, to_copy=%zu, remain=%zu\n",
+					slot, to_copy, remain - to_copy);
+
+		/* wait until the slot is free again */
+		ret = fbtft_write_spi_wait(par, slot);
+		if (ret < 0)
+			goto out;
+
+		buf = par->txbuf.buf + slot * slot_size;
+		txbuf16 = (u16 *)(buf + startbyte_size);
+		if (par->startbyte)
+			*buf = par->startbyte | 0x2;
+
+		fbtft_convert_vmem16(par, txbuf16, vmem16, to_copy);
+
+		vmem16 = vmem16 + to_copy;
+		ret = fbtft_write_spi_async(par, slot, buf,
+						startbyte_size + to_copy * 2);
+		if (ret < 0)
+			goto out;
+		remain -= to_copy;
+		slot = (slot + 1) % FBTFT_TX_SLOTS;
+	}
+
+out:
+	/* the caller may change dc or the window when we return */
+	for (i = 0; i < FBTFT_TX_SLOTS; i++) {
+		err = fbtft_write_spi_wait(par, i);
+		if (err < 0 && ret >= 0)
+			ret = err;
+	}
+
+	return ret;
+}
+
 /* 16 bit pixel over 8-bit databus */
 int fbtft_write_vmem16_bus8(struct fbtft_par *par, size_t offset, size_t len)
 {
@@ -134,7 +437,6 @@ int fbtft_write_vmem16_bus8(struct fbtft_par *par, size_t offset, size_t len)
 	size_t remain;
 	size_t to_copy;
 	size_t tx_array_size;
-	int i;
 	int ret = 0;
 	size_t startbyte_size = 0;
 
@@ -142,21 +444,39 @@ int fbtft_write_vmem16_bus8(struct fbtft_par *par, size_t offset, size_t len)
 		__func__, offset, len);
 
 	remain = len / 2;
-	vmem16 = (u16 *)(par->info->screen_base + offset);
+	vmem16 = (u16 *)(par->vmem + offset);
 
 	if (par->gpio.dc != -1)
 		gpio_set_value(par->gpio.dc, 1);
 
+	/*
+	 * Big endian video memory needs no conversion, but it can only be
+	 * sent directly if it is DMA mapped. Otherwise it is copied into
+	 * txbuf as is.
+	 */
+	if (par->big_endian && !par->startbyte && par->vmem_dma &&
+	    par->vmem == (u8 __force *)par->info->screen_base)
+		return par->fbtftops.write(par, vmem16, len);
+
 	/* non buffered write */
 	if (!par->txbuf.buf)
 		return par->fbtftops.write(par, vmem16, len);
 
+	if (par->txbuf.chunk < 2) {
+		dev_err(par->info->device, "%s: no room in txbuf\n", __func__);
+		return -EINVAL;
+	}
+
+	/* overlap conversion and transfer if it takes more than one slot */
+	if (par->pipeline.enabled && par->fbtftops.write == fbtft_write_spi &&
+			len > par->txbuf.len / FBTFT_TX_SLOTS)
+		return fbtft_write_vmem16_bus8_pipelined(par, vmem16, remain);
+
 	/* buffered write */
-	tx_array_size = par->txbuf.len / 2;
+	tx_array_size = par->txbuf.chunk / 2;
 
 	if (par->startbyte) {
 		txbuf16 = (u16 *)(par->txbuf.buf + 1);
-		tx_array_size -= 2;
 		*(u8 *)(par->txbuf.buf) = par->startbyte | 0x2;
 		startbyte_size = 1;
 	}
@@ -166,8 +486,7 @@ int fbtft_write_vmem16_bus8(struct fbtft_par *par, size_t offset, size_t len)
 		dev_dbg(par->info->device, "    to_copy=%zu, remain=%zu\n",
 						to_copy, remain - to_copy);
 
-		for (i = 0; i < to_copy; i++)
-			txbuf16[i] = cpu_to_be16(vmem16[i]);
+		fbtft_convert_vmem16(par, txbuf16, vmem16, to_copy);
 
 		vmem16 = vmem16 + to_copy;
 		ret = par->fbtftops.write(par, par->txbuf.buf,
@@ -201,24 +520,41 @@ int fbtft_write_vmem16_bus9(struct fbtft_par *par, size_t offset, size_t len)
 	}
 
 	remain = len;
-	vmem8 = par->info->screen_base + offset;
+	vmem8 = par->vmem + offset;
 
-	tx_array_size = par->txbuf.len / 2;
+	tx_array_size = par->txbuf.chunk;
+	if (!tx_array_size) {
+		dev_err(par->info->device, "%s: no room in txbuf\n", __func__);
+		return -EINVAL;
+	}
 
 	while (remain) {
 		to_copy = remain > tx_array_size ? tx_array_size : remain;
 		dev_dbg(par->info->device, "    to_copy=%zu, remain=%zu\n",
 						to_copy, remain - to_copy);
 
-#ifdef __LITTLE_ENDIAN
-		for (i = 0; i < to_copy; i += 2) {
-			txbuf16[i]   = 0x0100 | vmem8[i+1];
-			txbuf16[i+1] = 0x0100 | vmem8[i];
+		/* 9-bit emulation: pack straight into the bitstream */
+		if (par->fbtftops.write == fbtft_write_spi_emulate_9) {
+			ret = fbtft_write_spi(par, par->extra,
+				fbtft_convert_bus9(par, par->extra, vmem8,
+								to_copy));
+			if (ret < 0)
+				return ret;
+			vmem8 = vmem8 + to_copy;
+			remain -= to_copy;
+			continue;
 		}
-#else
+
+#ifdef __LITTLE_ENDIAN
+		if (!par->big_endian) {
+			for (i = 0; i < to_copy; i += 2) {
+				txbuf16[i]   = 0x0100 | vmem8[i+1];
+				txbuf16[i+1] = 0x0100 | vmem8[i];
+			}
+		} else
+#endif
 		for (i = 0; i < to_copy; i++)
 			txbuf16[i]   = 0x0100 | vmem8[i];
-#endif
 		vmem8 = vmem8 + to_copy;
 		ret = par->fbtftops.write(par, par->txbuf.buf, to_copy*2);
 		if (ret < 0)
@@ -245,7 +581,7 @@ int fbtft_write_vmem16_bus16(struct fbtft_par *par, size_t offset, size_t len)
 	fbtft_par_dbg(DEBUG_WRITE_VMEM, par, "%s(offset=%zu, len=%zu)\n",
 		__func__, offset, len);
 
-	vmem16 = (u16 *)(par->info->screen_base + offset);
+	vmem16 = (u16 *)(par->vmem + offset);
 
 	if (par->gpio.dc != -1)
 		gpio_set_value(par->gpio.dc, 1);
@@ -39,6 +39,11 @@
 #include <linux/dma-mapping.h>
 #include <linux/of.h>
 #include <linux/of_gpio.h>
+#include <linux/kthread.h>
+#include <linux/sched.h>
+#include <linux/cpumask.h>
+#include <linux/hrtimer.h>
+#include <linux/math64.h>
 
 #include "fbtft.h"
 
@@ -56,6 +61,36 @@ static bool dma = true;
 module_param(dma, bool, 0);
 MODULE_PARM_DESC(dma, "Use DMA buffer");
 
+static bool dmavmem;
+module_param(dmavmem, bool, 0);
+MODULE_PARM_DESC(dmavmem,
+	"Physically contiguous video memory, sent by DMA without copying");
+
+static bool dmastream;
+module_param(dmastream, bool, 0);
+MODULE_PARM_DESC(dmastream,
+	"Use a cached buffer mapped for streaming DMA instead of the DMA buffer");
+
+static unsigned convcpus = 1;
+module_param(convcpus, uint, 0);
+MODULE_PARM_DESC(convcpus,
+	"Number of CPUs converting large updates (0 = all online, max 4, default 1)");
+
+static bool calibrate;
+module_param(calibrate, bool, 0);
+MODULE_PARM_DESC(calibrate,
+	"Find the fastest pixel clock that reads back correctly at probe");
+
+static bool autotune;
+module_param(autotune, bool, 0);
+MODULE_PARM_DESC(autotune,
+	"Time full frame updates at probe to pick the fastest transfer size");
+
+static bool pipeline;
+module_param(pipeline, bool, 0);
+MODULE_PARM_DESC(pipeline,
+	"Overlap pixel conversion with asynchronous SPI transfers");
+
 
 void fbtft_dbg_hex(const struct device *dev, int groupsize,
 			void *buf, size_t len, const char *fmt, ...)
@@ -367,13 +402,19 @@ void fbtft_reset(struct fbtft_par *par)
 }
 
 
-void fbtft_update_display(struct fbtft_par *par, unsigned start_line, unsigned end_line)
+void fbtft_update_display(struct fbtft_par *par, unsigned xs, unsigned ys,
+						unsigned xe, unsigned ye)
 {
-	size_t offset, len;
+	size_t offset, len, line_len, n;
+	unsigned bytes_per_pixel = par->info->var.bits_per_pixel / 8;
+	unsigned xmax = par->info->var.xres - 1;
+	unsigned ymax = par->info->var.yres - 1;
 	struct timespec ts_start, ts_end, ts_fps, ts_duration;
 	long fps_ms, fps_us, duration_ms, duration_us;
 	long fps, throughput;
 	bool timeit = false;
+	u8 *vmem;
+	unsigned y;
 	int ret = 0;
 
 	if (unlikely(par->debug & (DEBUG_TIME_FIRST_UPDATE | DEBUG_TIME_EACH_UPDATE))) {
@@ -385,31 +426,70 @@ void fbtft_update_display(struct fbtft_par *par, unsigned start_line, unsigned e
 	}
 
 	/* Sanity checks */
-	if (start_line > end_line) {
+	if (ys > ye || xs > xe) {
 		dev_warn(par->info->device,
-			"%s: start_line=%u is larger than end_line=%u. Shouldn't happen, will do full display update\n",
-			__func__, start_line, end_line);
-		start_line = 0;
-		end_line = par->info->var.yres - 1;
+			"%s: xs=%u, ys=%u is larger than xe=%u, ye=%u. Shouldn't happen, will do full display update\n",
+			__func__, xs, ys, xe, ye);
+		xs = 0;
+		ys = 0;
+		xe = xmax;
+		ye = ymax;
 	}
-	if (start_line > par->info->var.yres - 1 || end_line > par->info->var.yres - 1) {
+	if (ye > ymax || xe > xmax) {
 		dev_warn(par->info->device,
-			"%s: start_line=%u or end_line=%u is larger than max=%d. Shouldn't happen, will do full display update\n",
-			__func__, start_line, end_line, par->info->var.yres - 1);
-		start_line = 0;
-		end_line = par->info->var.yres - 1;
+			"%s: xe=%u or ye=%u is larger than max=%u,%u. Shouldn't happen, will do full display update\n",
+			__func__, xe, ye, xmax, ymax);
+		xs = 0;
+		ys = 0;
+		xe = xmax;
+		ye = ymax;
 	}
 
-	fbtft_par_dbg(DEBUG_UPDATE_DISPLAY, par, "%s(start_line=%u, end_line=%u)\n",
-		__func__, start_line, end_line);
+	/* the whole line is sent if the controller can't do a column window */
+	if (!par->col_window || !bytes_per_pixel) {
+		xs = 0;
+		xe = xmax;
+	}
 
-	if (par->fbtftops.set_addr_win)
-		par->fbtftops.set_addr_win(par, 0, start_line,
-				par->info->var.xres-1, end_line);
+	fbtft_par_dbg(DEBUG_UPDATE_DISPLAY, par,
+		"%s(xs=%u, ys=%u, xe=%u, ye=%u)\n", __func__, xs, ys, xe, ye);
 
-	offset = start_line * par->info->fix.line_length;
-	len = (end_line - start_line + 1) * par->info->fix.line_length;
-	ret = par->fbtftops.write_vmem(par, offset, len);
+	if (par->fbtftops.set_addr_win)
+		par->fbtftops.set_addr_win(par, xs, ys, xe, ye);
+
+	if (xs == 0 && xe == xmax) {
+		/* full lines are contiguous in video memory */
+		offset = ys * par->info->fix.line_length;
+		len = (ye - ys + 1) * par->info->fix.line_length;
+		ret = par->fbtftops.write_vmem(par, offset, len);
+	} else if (par->gather && (xe - xs + 1) * bytes_per_pixel <=
+							par->txbuf.len) {
+		/* the window is contiguous on the display side, gather it */
+		line_len = (xe - xs + 1) * bytes_per_pixel;
+		len = (ye - ys + 1) * line_len;
+		vmem = par->vmem;
+		offset = ys * par->info->fix.line_length + xs * bytes_per_pixel;
+		for (y = ys; y <= ye && ret >= 0; ) {
+			for (n = 0; y <= ye && n + line_len <= par->txbuf.len;
+							y++, n += line_len) {
+				memcpy(par->gather + n, vmem + offset, line_len);
+				offset += par->info->fix.line_length;
+			}
+			par->vmem = par->gather;
+			ret = par->fbtftops.write_vmem(par, 0, n);
+			par->vmem = vmem;
+		}
+	} else {
+		line_len = (xe - xs + 1) * bytes_per_pixel;
+		len = (ye - ys + 1) * line_len;
+		for (y = ys; y <= ye; y++) {
+			offset = y * par->info->fix.line_length +
+							xs * bytes_per_pixel;
+			ret = par->fbtftops.write_vmem(par, offset, line_len);
+			if (ret < 0)
+				break;
+		}
+	}
 	if (ret < 0)
 		dev_err(par->info->device,
 			"%s: write_vmem failed to update display buffer\n",
@@ -445,46 +525,410 @@ void fbtft_update_display(struct fbtft_par *par, unsigned start_line, unsigned e
 }
 
 
-void fbtft_mkdirty(struct fb_info *info, int y, int height)
+static void fbtft_mark_tiles(struct fbtft_par *par, unsigned long *tiles,
+			unsigned xs, unsigned ys, unsigned xe, unsigned ye)
+{
+	unsigned col, row;
+
+	xs /= FBTFT_TILE_WIDTH;
+	xe /= FBTFT_TILE_WIDTH;
+	ys /= FBTFT_TILE_HEIGHT;
+	ye /= FBTFT_TILE_HEIGHT;
+
+	for (row = ys; row <= ye; row++)
+		for (col = xs; col <= xe; col++)
+			set_bit(row * par->dirty.cols + col, tiles);
+}
+
+/*
+ * Arm the frame timer for the next frame boundary, if not already armed.
+ * Returns false if there is no update thread to send the damage.
+ */
+static bool fbtft_frame_schedule(struct fbtft_par *par)
+{
+	ktime_t now, expires;
+	unsigned long flags;
+	u64 frames;
+
+	spin_lock_irqsave(&par->frame.lock, flags);
+	/* fbtft_worker_stop() may have run since the caller looked */
+	if (!par->worker.task) {
+		spin_unlock_irqrestore(&par->frame.lock, flags);
+		return false;
+	}
+
+	if (hrtimer_is_queued(&par->frame.timer)) {
+		par->frame.coalesced++;
+		goto out;
+	}
+
+	now = ktime_get();
+
+	/*
+	 * Leading edge: if nothing was sent for a whole period, send this
+	 * damage right away and align the frame clock to it. Damage that
+	 * follows within the period is coalesced as usual.
+	 */
+	if (par->frame.leading_edge && !par->frame.busy &&
+	    ktime_to_ns(ktime_sub(now, par->frame.last_update)) >=
+							par->frame.period) {
+		par->frame.epoch = now;
+		par->frame.last_update = now;
+		queue_kthread_work(&par->worker.kworker, &par->worker.work);
+		goto out;
+	}
+
+	frames = div64_u64(ktime_to_ns(ktime_sub(now, par->frame.epoch)),
+							par->frame.period);
+	expires = ktime_add_ns(par->frame.epoch,
+					(frames + 1) * par->frame.period);
+	hrtimer_start(&par->frame.timer, expires, HRTIMER_MODE_ABS);
+out:
+	spin_unlock_irqrestore(&par->frame.lock, flags);
+	return true;
+}
+
+static enum hrtimer_restart fbtft_frame_timer(struct hrtimer *timer)
+{
+	struct fbtft_par *par = container_of(timer, struct fbtft_par,
+						frame.timer);
+
+	if (!queue_kthread_work(&par->worker.kworker, &par->worker.work))
+		par->frame.coalesced++;
+
+	return HRTIMER_NORESTART;
+}
+
+void fbtft_mkdirty(struct fb_info *info, int x, int y, int width, int height)
 {
 	struct fbtft_par *par = info->par;
 	struct fb_deferred_io *fbdefio = info->fbdefio;
+	int xe, ye;
 
 	/* special case, needed ? */
 	if (y == -1) {
+		x = 0;
 		y = 0;
-		height = info->var.yres - 1;
+		width = info->var.xres;
+		height = info->var.yres;
 	}
 
-	/* Mark display lines/area as dirty */
-	spin_lock(&par->dirty_lock);
-	if (y < par->dirty_lines_start)
-		par->dirty_lines_start = y;
-	if (y + height - 1 > par->dirty_lines_end)
-		par->dirty_lines_end = y + height - 1;
-	spin_unlock(&par->dirty_lock);
+	/* clip to the display */
+	xe = min_t(int, x + width, info->var.xres) - 1;
+	ye = min_t(int, y + height, info->var.yres) - 1;
+	x = max(x, 0);
+	y = max(y, 0);
+	if (x > xe || y > ye)
+		return;
+
+	/* Mark display tiles as dirty */
+	fbtft_mark_tiles(par, par->dirty.tiles, x, y, xe, ye);
+
+	if (fbtft_frame_schedule(par))
+		return;
 
 	/* Schedule deferred_io to update display (no-op if already on queue)*/
 	schedule_delayed_work(&info->deferred_work, fbdefio->delay);
 }
 
+static void fbtft_flush_tile_span(struct fbtft_par *par,
+				struct fbtft_tile_span *span, unsigned ye)
+{
+	unsigned xmax = par->info->var.xres - 1;
+	unsigned ymax = par->info->var.yres - 1;
+
+	par->fbtftops.update_display(par,
+		span->xs * FBTFT_TILE_WIDTH,
+		span->ys * FBTFT_TILE_HEIGHT,
+		min(span->xe * FBTFT_TILE_WIDTH + FBTFT_TILE_WIDTH - 1, xmax),
+		min(ye * FBTFT_TILE_HEIGHT + FBTFT_TILE_HEIGHT - 1, ymax));
+}
+
+/*
+ * Walk the pending tiles row by row. Each run of dirty tiles in a row is
+ * a span, and a span continues the rectangle above it if it covers the
+ * same columns. Rectangles that don't continue are sent to the display.
+ * Without column window support every update is full width, so all dirty
+ * rows are merged into one band and sent with a single update.
+ */
+static void fbtft_update_dirty_tiles(struct fbtft_par *par)
+{
+	unsigned long *pending = par->dirty.pending;
+	unsigned cols = par->dirty.cols;
+	struct fbtft_tile_span *open = par->dirty.open;
+	struct fbtft_tile_span *next = par->dirty.next;
+	struct fbtft_tile_span *tmp;
+	unsigned num_tiles = cols * par->dirty.rows;
+	unsigned num_open = 0, num_next, i, j;
+	unsigned row, xs, xe;
+
+	if (!par->col_window) {
+		xs = find_first_bit(pending, num_tiles);
+		if (xs >= num_tiles)
+			return;
+		open[0].xs = 0;
+		open[0].xe = cols - 1;
+		open[0].ys = xs / cols;
+		fbtft_flush_tile_span(par, &open[0],
+					find_last_bit(pending, num_tiles) / cols);
+		return;
+	}
+
+	for (row = 0; row < par->dirty.rows; row++) {
+		num_next = 0;
+		xs = find_next_bit(pending, (row + 1) * cols, row * cols);
+		while (xs < (row + 1) * cols) {
+			xe = find_next_zero_bit(pending, (row + 1) * cols, xs);
+			next[num_next].xs = xs - row * cols;
+			next[num_next].xe = xe - 1 - row * cols;
+			next[num_next].ys = row;
+			num_next++;
+			xs = find_next_bit(pending, (row + 1) * cols, xe);
+		}
+
+		/* both lists are sorted by column */
+		for (i = 0, j = 0; i < num_open; i++) {
+			while (j < num_next && next[j].xs < open[i].xs)
+				j++;
+			if (j < num_next && next[j].xs == open[i].xs &&
+						next[j].xe == open[i].xe)
+				next[j].ys = open[i].ys;
+			else
+				fbtft_flush_tile_span(par, &open[i], row - 1);
+		}
+
+		tmp = open;
+		open = next;
+		next = tmp;
+		num_open = num_next;
+	}
+
+	for (i = 0; i < num_open; i++)
+		fbtft_flush_tile_span(par, &open[i], par->dirty.rows - 1);
+}
+
+static bool fbtft_shadow_equal(const u8 *a, const u8 *b, size_t len)
+{
+	const unsigned long *la = (const unsigned long *)a;
+	const unsigned long *lb = (const unsigned long *)b;
+
+	if (!IS_ALIGNED((unsigned long)a | len, sizeof(long)))
+		return !memcmp(a, b, len);
+
+	for (len /= sizeof(long); len; len--)
+		if (*la++ != *lb++)
+			return false;
+
+	return true;
+}
+
+/*
+ * Drop pending tiles that are identical to what the display already has,
+ * and copy the others from @vmem into the shadow. The shadow is what gets
+ * sent then, so it can't differ from what the display received.
+ */
+static void fbtft_shadow_filter(struct fbtft_par *par, const u8 *vmem)
+{
+	struct fb_info *info = par->info;
+	u8 *shadow = par->shadow.buf;
+	unsigned long *pending = par->dirty.pending;
+	unsigned num_tiles = par->dirty.cols * par->dirty.rows;
+	unsigned bpp = info->var.bits_per_pixel;
+	unsigned tile, x0, x1, y0, y1, y;
+	size_t offset, len;
+	bool changed;
+
+	if (par->shadow.sync) {
+		par->shadow.sync = false;
+		memcpy(shadow, vmem, info->fix.smem_len);
+		bitmap_fill(pending, num_tiles);
+		return;
+	}
+
+	for_each_set_bit(tile, pending, num_tiles) {
+		x0 = (tile % par->dirty.cols) * FBTFT_TILE_WIDTH;
+		x1 = min(x0 + FBTFT_TILE_WIDTH, info->var.xres);
+		y0 = (tile / par->dirty.cols) * FBTFT_TILE_HEIGHT;
+		y1 = min(y0 + FBTFT_TILE_HEIGHT, info->var.yres);
+		offset = y0 * info->fix.line_length + x0 * bpp / 8;
+		len = (x1 - x0) * bpp / 8;
+
+		changed = false;
+		for (y = y0; y < y1; y++) {
+			if (!fbtft_shadow_equal(vmem + offset, shadow + offset,
+									len)) {
+				changed = true;
+				break;
+			}
+			offset += info->fix.line_length;
+		}
+
+		if (!changed) {
+			__clear_bit(tile, pending);
+			par->shadow.bytes_saved += len * (y1 - y0);
+			par->shadow.tiles_skipped++;
+			continue;
+		}
+
+		/* the rows before y are already equal */
+		for (; y < y1; y++) {
+			memcpy(shadow + offset, vmem + offset, len);
+			offset += info->fix.line_length;
+		}
+	}
+}
+
+/*
+ * Copy the pending tiles into the snapshot buffer so write_vmem() works on
+ * a stable frame while userspace keeps drawing into the video memory.
+ * Tiles that aren't pending are unchanged since they were last copied.
+ */
+static void fbtft_snapshot_tiles(struct fbtft_par *par)
+{
+	struct fb_info *info = par->info;
+	u8 *vmem = (u8 __force *)info->screen_base;
+	u8 *snapshot = par->snapshot.buf;
+	unsigned long *pending = par->dirty.pending;
+	unsigned num_tiles = par->dirty.cols * par->dirty.rows;
+	unsigned bpp = info->var.bits_per_pixel;
+	unsigned tile, x0, x1, y0, y1, y;
+	size_t offset, len;
+
+	/* switching over, start with a complete copy */
+	if (par->vmem != snapshot) {
+		memcpy(snapshot, vmem, info->fix.smem_len);
+		par->vmem = snapshot;
+		return;
+	}
+
+	for_each_set_bit(tile, pending, num_tiles) {
+		x0 = (tile % par->dirty.cols) * FBTFT_TILE_WIDTH;
+		x1 = min(x0 + FBTFT_TILE_WIDTH, info->var.xres);
+		y0 = (tile / par->dirty.cols) * FBTFT_TILE_HEIGHT;
+		y1 = min(y0 + FBTFT_TILE_HEIGHT, info->var.yres);
+		offset = y0 * info->fix.line_length + x0 * bpp / 8;
+		len = (x1 - x0) * bpp / 8;
+
+		for (y = y0; y < y1; y++) {
+			memcpy(snapshot + offset, vmem + offset, len);
+			offset += info->fix.line_length;
+		}
+	}
+}
+
+/* Sends the dirty tiles to the display, runs on the update worker */
+static void fbtft_update_dirty(struct fbtft_par *par)
+{
+	unsigned num_tiles = par->dirty.cols * par->dirty.rows;
+	unsigned i;
+	bool shadow, snapshot;
+
+	/* take over the dirty tiles, mkdirty() can keep marking meanwhile */
+	for (i = 0; i < BITS_TO_LONGS(num_tiles); i++)
+		par->dirty.pending[i] = xchg(&par->dirty.tiles[i], 0);
+
+	/* pairs with smp_wmb() in store_shadow() and store_snapshot() */
+	shadow = ACCESS_ONCE(par->shadow.enabled);
+	snapshot = ACCESS_ONCE(par->snapshot.enabled);
+	smp_rmb();
+
+	if (snapshot)
+		fbtft_snapshot_tiles(par);
+	else
+		par->vmem = (u8 __force *)par->info->screen_base;
+
+	/* diff against the frame that is actually going to be sent */
+	if (shadow)
+		fbtft_shadow_filter(par, par->vmem);
+
+	/* without a snapshot, send the shadow copy */
+	if (shadow && par->vmem != par->snapshot.buf)
+		par->vmem = par->shadow.buf;
+
+	fbtft_update_dirty_tiles(par);
+}
+
+/*
+ * Stretch the frame period so the bus isn't busy more than the policy
+ * allows, within the min_fps..max_fps range. Backpressure keeps updates
+ * from queuing up back-to-back when the display can't keep up.
+ */
+static void fbtft_frame_adapt(struct fbtft_par *par, ktime_t start)
+{
+	static const unsigned duty[] = {
+		[FBTFT_FRAME_LATENCY] = 100,
+		[FBTFT_FRAME_THROUGHPUT] = 75,
+		[FBTFT_FRAME_POWER] = 25,
+	};
+	u64 min_period = div_u64(NSEC_PER_SEC, max(par->frame.max_fps, 1U));
+	u64 max_period = div_u64(NSEC_PER_SEC, max(par->frame.min_fps, 1U));
+	unsigned long flags;
+	u64 period, old;
+
+	period = div_u64(par->frame.update_time * 100,
+						duty[par->frame.policy]);
+	period = clamp(period, min_period, max(min_period, max_period));
+
+	spin_lock_irqsave(&par->frame.lock, flags);
+	old = par->frame.period;
+	if (period != old) {
+		/* restart the frame clock at this update */
+		par->frame.epoch = start;
+		par->frame.period = period;
+	}
+	spin_unlock_irqrestore(&par->frame.lock, flags);
+
+	if (period != old)
+		fbtft_par_dbg(DEBUG_UPDATE_DISPLAY, par,
+			"%s: frame period %llu -> %llu ns\n", __func__,
+			old, period);
+}
+
+static void fbtft_update_work(struct kthread_work *work)
+{
+	struct fbtft_par *par = container_of(work, struct fbtft_par,
+						worker.work);
+	ktime_t start = ktime_get();
+	ktime_t end;
+	unsigned long flags;
+	u64 duration, period;
+
+	spin_lock_irqsave(&par->frame.lock, flags);
+	par->frame.busy = true;
+	spin_unlock_irqrestore(&par->frame.lock, flags);
+
+	fbtft_update_dirty(par);
+	end = ktime_get();
+
+	spin_lock_irqsave(&par->frame.lock, flags);
+	par->frame.last_update = end;
+	par->frame.busy = false;
+	period = par->frame.period;
+	spin_unlock_irqrestore(&par->frame.lock, flags);
+
+	duration = ktime_to_ns(ktime_sub(end, start));
+	par->frame.updates++;
+	if (duration > period)
+		par->frame.dropped += div64_u64(duration, period);
+
+	/* moving average, weight 1/4 */
+	if (par->frame.update_time)
+		par->frame.update_time += div_s64((s64)duration -
+					(s64)par->frame.update_time, 4);
+	else
+		par->frame.update_time = duration;
+
+	fbtft_frame_adapt(par, start);
+}
+
 void fbtft_deferred_io(struct fb_info *info, struct list_head *pagelist)
 {
 	struct fbtft_par *par = info->par;
-	unsigned dirty_lines_start, dirty_lines_end;
 	struct page *page;
 	unsigned long index;
 	unsigned y_low = 0, y_high = 0;
 	int count = 0;
 
-	spin_lock(&par->dirty_lock);
-	dirty_lines_start = par->dirty_lines_start;
-	dirty_lines_end = par->dirty_lines_end;
-	/* set display line markers as clean */
-	par->dirty_lines_start = par->info->var.yres - 1;
-	par->dirty_lines_end = 0;
-	spin_unlock(&par->dirty_lock);
-
 	/* Mark display lines as dirty */
 	list_for_each_entry(page, pagelist, lru) {
 		count++;
@@ -496,14 +940,120 @@ void fbtft_deferred_io(struct fb_info *info, struct list_head *pagelist)
 			page->index, y_low, y_high);
 		if (y_high > info->var.yres - 1)
 			y_high = info->var.yres - 1;
-		if (y_low < dirty_lines_start)
-			dirty_lines_start = y_low;
-		if (y_high > dirty_lines_end)
-			dirty_lines_end = y_high;
+		if (y_low > y_high)
+			continue;
+		/* pages span whole lines */
+		fbtft_mark_tiles(par, par->dirty.tiles,
+				0, y_low, info->var.xres - 1, y_high);
+	}
+
+	/* leave the transfer to the display's own thread if we have one */
+	if (!fbtft_frame_schedule(par))
+		fbtft_update_dirty(par);
+}
+
+/**
+ * fbtft_worker_set_sched() - Apply scheduling policy to the update thread
+ * @par: Driver data
+ *
+ * Uses @worker.rt_priority and @worker.cpu_affinity
+ *
+ * Return: 0 if successful, negative if error
+ */
+int fbtft_worker_set_sched(struct fbtft_par *par)
+{
+	struct sched_param param = { .sched_priority = 0 };
+	struct task_struct *task = par->worker.task;
+	cpumask_var_t mask;
+	int policy = SCHED_NORMAL;
+	int cpu, ret;
+
+	if (!task)
+		return -ENODEV;
+
+	if (par->worker.rt_priority) {
+		policy = SCHED_FIFO;
+		param.sched_priority = min_t(unsigned, par->worker.rt_priority,
+							MAX_USER_RT_PRIO - 1);
+	}
+	ret = sched_setscheduler(task, policy, &param);
+	if (ret) {
+		dev_err(par->info->device,
+			"%s: sched_setscheduler() failed with %d\n",
+			__func__, ret);
+		return ret;
 	}
 
-	par->fbtftops.update_display(info->par,
-					dirty_lines_start, dirty_lines_end);
+	if (!alloc_cpumask_var(&mask, GFP_KERNEL))
+		return -ENOMEM;
+	if (par->worker.cpu_affinity) {
+		cpumask_clear(mask);
+		for_each_set_bit(cpu, &par->worker.cpu_affinity, BITS_PER_LONG)
+			if (cpu < nr_cpu_ids)
+				cpumask_set_cpu(cpu, mask);
+	} else {
+		cpumask_copy(mask, cpu_possible_mask);
+	}
+	ret = set_cpus_allowed_ptr(task, mask);
+	free_cpumask_var(mask);
+	if (ret)
+		dev_err(par->info->device,
+			"%s: set_cpus_allowed_ptr() failed with %d\n",
+			__func__, ret);
+
+	return ret;
+}
+
+static void fbtft_worker_start(struct fbtft_par *par)
+{
+	struct task_struct *task;
+	unsigned long flags;
+
+	init_kthread_worker(&par->worker.kworker);
+	init_kthread_work(&par->worker.work, fbtft_update_work);
+	task = kthread_run(kthread_worker_fn, &par->worker.kworker,
+						"fbtft/fb%d", par->info->node);
+	if (IS_ERR(task)) {
+		/* updates are then done by the deferred io work */
+		dev_warn(par->info->device,
+			"failed to start update thread (%ld)\n", PTR_ERR(task));
+		return;
+	}
+
+	/*
+	 * The frame timer paces the updates from now on. Deferred io only
+	 * has to collect the written pages, so keep its delay short.
+	 */
+	hrtimer_init(&par->frame.timer, CLOCK_MONOTONIC, HRTIMER_MODE_ABS);
+	par->frame.timer.function = fbtft_frame_timer;
+	par->frame.epoch = ktime_get();
+	par->info->fbdefio->delay = 1;
+
+	/*
+	 * The framebuffer is already registered, mkdirty() and deferred io
+	 * use the timer as soon as they see the task.
+	 */
+	spin_lock_irqsave(&par->frame.lock, flags);
+	par->worker.task = task;
+	spin_unlock_irqrestore(&par->frame.lock, flags);
+	fbtft_worker_set_sched(par);
+}
+
+static void fbtft_worker_stop(struct fbtft_par *par)
+{
+	struct task_struct *task;
+	unsigned long flags;
+
+	/* once the task is cleared, fbtft_frame_schedule() can't rearm */
+	spin_lock_irqsave(&par->frame.lock, flags);
+	task = par->worker.task;
+	par->worker.task = NULL;
+	spin_unlock_irqrestore(&par->frame.lock, flags);
+	if (!task)
+		return;
+	hrtimer_cancel(&par->frame.timer);
+	flush_kthread_worker(&par->worker.kworker);
+	kthread_stop(task);
 }
 
 
@@ -516,7 +1066,8 @@ void fbtft_fb_fillrect(struct fb_info *info, const struct fb_fillrect *rect)
 		__func__, rect->dx, rect->dy, rect->width, rect->height);
 	sys_fillrect(info, rect);
 
-	par->fbtftops.mkdirty(info, rect->dy, rect->height);
+	par->fbtftops.mkdirty(info, rect->dx, rect->dy,
+				rect->width, rect->height);
 }
 
 void fbtft_fb_copyarea(struct fb_info *info, const struct fb_copyarea *area)
@@ -528,7 +1079,8 @@ void fbtft_fb_copyarea(struct fb_info *info, const struct fb_copyarea *area)
 		__func__,  area->dx, area->dy, area->width, area->height);
 	sys_copyarea(info, area);
 
-	par->fbtftops.mkdirty(info, area->dy, area->height);
+	par->fbtftops.mkdirty(info, area->dx, area->dy,
+				area->width, area->height);
 }
 
 void fbtft_fb_imageblit(struct fb_info *info, const struct fb_image *image)
@@ -540,7 +1092,8 @@ void fbtft_fb_imageblit(struct fb_info *info, const struct fb_image *image)
 		__func__,  image->dx, image->dy, image->width, image->height);
 	sys_imageblit(info, image);
 
-	par->fbtftops.mkdirty(info, image->dy, image->height);
+	par->fbtftops.mkdirty(info, image->dx, image->dy,
+				image->width, image->height);
 }
 
 ssize_t fbtft_fb_write(struct fb_info *info,
@@ -555,7 +1108,7 @@ ssize_t fbtft_fb_write(struct fb_info *info,
 
 	/* TODO: only mark changed area
 	   update all for now */
-	par->fbtftops.mkdirty(info, -1, 0);
+	par->fbtftops.mkdirty(info, -1, -1, 0, 0);
 
 	return res;
 }
@@ -589,6 +1142,8 @@ int fbtft_fb_setcolreg(unsigned regno,
 			val |= chan_to_field(green, &info->var.green);
 			val |= chan_to_field(blue,  &info->var.blue);
 
+			if (par->big_endian)
+				val = cpu_to_be16(val);
 			pal[regno] = val;
 			ret = 0;
 		}
@@ -661,6 +1216,360 @@ void fbtft_merge_fbtftops(struct fbtft_ops *dst, struct fbtft_ops *src)
 		dst->set_gamma = src->set_gamma;
 }
 
+static void fbtft_vmem_free(void *vmem, size_t size)
+{
+	if (!vmem)
+		return;
+	if (is_vmalloc_addr(vmem))
+		vfree(vmem);
+	else
+		free_pages_exact(vmem, size);
+}
+
+/*
+ * Map the cached transmit buffer and physically contiguous video memory
+ * for the SPI controller. Writes from video memory can then be sent
+ * without going through the transmit buffer.
+ */
+static void fbtft_dma_map(struct fbtft_par *par)
+{
+	struct fb_info *info = par->info;
+	struct device *dmadev;
+	dma_addr_t dma;
+
+	if (!par->spi) {
+		par->txbuf.streaming = false;
+		return;
+	}
+	dmadev = par->spi->master->dev.parent;
+
+	if (par->txbuf.streaming) {
+		dma = dma_map_single(dmadev, par->txbuf.buf, par->txbuf.len,
+							DMA_TO_DEVICE);
+		if (dma_mapping_error(dmadev, dma)) {
+			dev_warn(info->device,
+				"failed to map transmit buffer for DMA\n");
+			par->txbuf.streaming = false;
+		} else {
+			par->txbuf.dma = dma;
+			/* the CPU owns it until the first write */
+			dma_sync_single_for_cpu(dmadev, dma, par->txbuf.len,
+							DMA_TO_DEVICE);
+		}
+	}
+
+	if (is_vmalloc_addr((void __force *)info->screen_base))
+		return;
+
+	dma = dma_map_single(dmadev, (void __force *)info->screen_base,
+				info->fix.smem_len, DMA_TO_DEVICE);
+	if (dma_mapping_error(dmadev, dma)) {
+		dev_warn(info->device, "failed to map video memory for DMA\n");
+		return;
+	}
+	par->vmem_dma = dma;
+}
+
+static void fbtft_dma_unmap(struct fbtft_par *par)
+{
+	if (par->txbuf.streaming && par->txbuf.dma) {
+		dma_unmap_single(par->spi->master->dev.parent, par->txbuf.dma,
+					par->txbuf.len, DMA_TO_DEVICE);
+		par->txbuf.dma = 0;
+	}
+	if (par->vmem_dma) {
+		dma_unmap_single(par->spi->master->dev.parent, par->vmem_dma,
+					par->info->fix.smem_len, DMA_TO_DEVICE);
+		par->vmem_dma = 0;
+	}
+}
+
+/*
+ * Decide how much video memory goes into each transfer: as much as the
+ * transmit buffer and controller allow, rounded down to whole display
+ * lines or, failing that, to cache lines for the DMA engine.
+ */
+static void fbtft_set_chunking(struct fbtft_par *par)
+{
+	size_t line = par->info->fix.line_length;
+	size_t room = par->txbuf.len;
+	size_t frame_len, need;
+	unsigned n;
+
+	if (par->max_transfer && par->max_transfer < 4) {
+		dev_warn(par->info->device,
+			"max-transfer-size %zu is too small, using 4\n",
+			par->max_transfer);
+		par->max_transfer = 4;
+	}
+	par->max_transfer &= ~3;
+	if (par->max_transfer && par->max_transfer < room)
+		room = par->max_transfer;
+
+	if (par->fbtftops.write_vmem == fbtft_write_vmem16_bus9)
+		room /= 2; /* each byte is sent as a 9-bit word */
+	else if (par->startbyte)
+		room = room > 2 ? room - 2 : 0;
+
+	if (room >= line)
+		room = rounddown(room, line);
+	else if (room >= L1_CACHE_BYTES)
+		room = rounddown(room, L1_CACHE_BYTES);
+	else
+		room &= ~3;
+
+	/*
+	 * At least two 16-bit pixels, fbtft_write_spi() splits transfers
+	 * by max_transfer anyway. A transmit buffer that can't hold them
+	 * gets no chunk, and buffered writes fail instead of spinning.
+	 */
+	if (room < 4) {
+		room = 4;
+		if (par->fbtftops.write_vmem == fbtft_write_vmem16_bus9)
+			need = room * 2;
+		else
+			need = room + (par->startbyte ? 2 : 0);
+		if (need > par->txbuf.len) {
+			room = 0;
+			if (par->txbuf.buf)
+				dev_err(par->info->device,
+					"transmit buffer of %zu bytes is too small\n",
+					par->txbuf.len);
+		}
+	}
+	par->txbuf.chunk = room;
+
+	if (!par->spi)
+		return;
+
+	/* room for the reusable full frame message */
+	frame_len = max_t(size_t, par->info->fix.smem_len, par->txbuf.len);
+	n = par->max_transfer ? DIV_ROUND_UP(frame_len, par->max_transfer) : 1;
+	par->frame_msg.t = devm_kzalloc(par->info->device,
+				n * sizeof(struct spi_transfer), GFP_KERNEL);
+	if (par->frame_msg.t)
+		par->frame_msg.num_t = n;
+}
+
+/*
+ * Write a pattern to the start of the first line at the pixel clock and
+ * read it back at the read clock with RAMRD. The command and the data
+ * phase have to be one message, the controller aborts the read when CS
+ * goes high. On the serial interface the data follows one dummy clock,
+ * then 3 bytes (6 bits per color) per pixel.
+ */
+static bool fbtft_calibrate_check(struct fbtft_par *par, u8 *buf,
+							unsigned pixels)
+{
+	u16 *pattern = (u16 *)buf;
+	u8 *cmd = buf + pixels * 2;
+	u8 *rx = cmd + 1;
+	struct spi_transfer t[2] = {
+		{
+			.tx_buf = cmd,
+			.len = 1,
+			.speed_hz = par->speed_hz.read,
+		}, {
+			.rx_buf = rx,
+			/* one more byte for the bits after the dummy clock */
+			.len = pixels * 3 + 1,
+			.speed_hz = par->speed_hz.read,
+		},
+	};
+	struct spi_message m;
+	u16 val, swapped;
+	unsigned i;
+	int ret;
+
+	for (i = 0; i < pixels; i++) {
+		val = (i * 0x9E37) ^ 0xA5C3;
+		pattern[i] = cpu_to_be16(val);
+	}
+
+	par->fbtftops.set_addr_win(par, 0, 0, pixels - 1, 0);
+	gpio_set_value(par->gpio.dc, 1);
+	ret = par->fbtftops.write(par, pattern, pixels * 2);
+	if (ret < 0)
+		return false;
+
+	/* D/C is only sampled with the command byte, keep it low */
+	gpio_set_value(par->gpio.dc, 0);
+	*cmd = FBTFT_RAMRD;
+	memset(rx, 0, pixels * 3 + 1);
+	spi_message_init(&m);
+	spi_message_add_tail(&t[0], &m);
+	spi_message_add_tail(&t[1], &m);
+	ret = spi_sync(par->spi, &m);
+	if (ret < 0)
+		return false;
+
+	/* drop the dummy clock */
+	for (i = 0; i < pixels * 3; i++)
+		rx[i] = rx[i] << 1 | rx[i + 1] >> 7;
+
+	for (i = 0; i < pixels; i++) {
+		val = (rx[3 * i] >> 3) << 11 | (rx[3 * i + 1] >> 2) << 5 |
+		      rx[3 * i + 2] >> 3;
+		/* some controllers read back in BGR order */
+		swapped = (val & 0x001F) << 11 | (val & 0x07E0) | val >> 11;
+		if (be16_to_cpu(pattern[i]) != val &&
+		    be16_to_cpu(pattern[i]) != swapped)
+			return false;
+	}
+
+	return true;
+}
+
+/*
+ * Step the pixel clock up from the device speed in 25% steps until the
+ * pattern no longer reads back, then use the step below the highest one
+ * that worked as safety margin.
+ * Only done for 16 bpp MIPI DCS controllers on a plain 8-bit SPI bus
+ * with a D/C line.
+ */
+static void fbtft_calibrate_speed(struct fbtft_par *par)
+{
+	struct spi_device *spi = par->spi;
+	unsigned pixels = min_t(unsigned, par->info->var.xres,
+					FBTFT_CALIBRATE_PIXELS);
+	u32 speed = spi->max_speed_hz;
+	u32 good[FBTFT_CALIBRATE_STEPS];
+	unsigned n = 0;
+	u8 *buf;
+
+	if (par->fbtftops.set_addr_win != fbtft_set_addr_win ||
+	    par->fbtftops.write != fbtft_write_spi ||
+	    par->fbtftops.read != fbtft_read_spi ||
+	    par->fbtftops.write_register != fbtft_write_reg8_bus8 ||
+	    par->info->var.bits_per_pixel != 16 ||
+	    par->gpio.dc == -1 || par->startbyte || !speed)
+		return;
+
+	buf = kmalloc(pixels * 2 + 1 + pixels * 3 + 1, GFP_KERNEL);
+	if (!buf)
+		return;
+
+	while (n < FBTFT_CALIBRATE_STEPS) {
+		if (spi->master->max_speed_hz &&
+		    speed > spi->master->max_speed_hz)
+			break;
+		par->speed_hz.pixel = speed;
+		/* three passes to catch marginal clocks */
+		if (!fbtft_calibrate_check(par, buf, pixels) ||
+		    !fbtft_calibrate_check(par, buf, pixels) ||
+		    !fbtft_calibrate_check(par, buf, pixels))
+			break;
+		good[n++] = speed;
+		speed += speed / 4;
+	}
+	kfree(buf);
+
+	if (!n) {
+		dev_warn(par->info->device,
+			"calibrate: no readback at %u Hz, keeping pixel clock\n",
+			spi->max_speed_hz);
+		par->speed_hz.pixel = 0;
+		return;
+	}
+
+	par->speed_hz.pixel = good[n > 1 ? n - 2 : 0];
+	dev_info(par->info->device,
+		"calibrate: pixel clock %u Hz, highest verified %u Hz\n",
+		par->speed_hz.pixel, good[n - 1]);
+}
+
+/*
+ * Time full frame updates with chunks from one display line, doubling
+ * up to the largest one the transmit buffer holds, and keep the fastest.
+ * Each size is timed a few times and the best run counts, so a single
+ * preempted or interrupted update doesn't decide.
+ */
+static void fbtft_autotune_chunk(struct fbtft_par *par)
+{
+	struct fb_info *info = par->info;
+	size_t line = info->fix.line_length;
+	size_t max = par->txbuf.chunk;
+	size_t chunk = line;
+	unsigned n, run, best = 0;
+	ktime_t start;
+	u32 us;
+
+	if (par->fbtftops.write_vmem != fbtft_write_vmem16_bus8 &&
+	    par->fbtftops.write_vmem != fbtft_write_vmem16_bus9)
+		return;
+	/* sent straight from video memory, chunks don't matter */
+	if (par->big_endian && !par->startbyte && par->vmem_dma &&
+	    par->fbtftops.write_vmem == fbtft_write_vmem16_bus8)
+		return;
+	if (!par->txbuf.buf || max < line)
+		return;
+
+	for (n = 0; n < FBTFT_AUTOTUNE_STEPS; n++) {
+		if (chunk > max || n == FBTFT_AUTOTUNE_STEPS - 1)
+			chunk = max;
+		par->txbuf.chunk = chunk;
+
+		par->autotune.chunk[n] = chunk;
+		par->autotune.us[n] = ~0U;
+		for (run = 0; run < FBTFT_AUTOTUNE_RUNS; run++) {
+			start = ktime_get();
+			par->fbtftops.update_display(par, 0, 0,
+					info->var.xres - 1, info->var.yres - 1);
+			us = ktime_us_delta(ktime_get(), start);
+			par->autotune.us[n] = min(par->autotune.us[n], us);
+		}
+		if (par->autotune.us[n] < par->autotune.us[best])
+			best = n;
+
+		if (chunk == max)
+			break;
+		chunk *= 2;
+	}
+
+	par->autotune.num = n + 1;
+	par->autotune.best = best;
+	par->txbuf.chunk = par->autotune.chunk[best];
+	dev_info(info->device, "autotune: %zu byte chunks, %u us per frame\n",
+		par->autotune.chunk[best], par->autotune.us[best]);
+}
+
+/*
+ * Measure how fast pixels are converted into the transmit buffer,
+ * which depends a lot on the kind of memory it is. A streaming buffer
+ * also pays for handing it to the device and back on every write.
+ */
+static void fbtft_txbuf_benchmark(struct fbtft_par *par)
+{
+	struct device *dmadev = par->spi ? par->spi->master->dev.parent : NULL;
+	u16 *vmem16 = (u16 *)par->vmem;
+	size_t len = min_t(size_t, par->txbuf.len, par->info->fix.smem_len);
+	ktime_t start;
+	u64 ns;
+	int pass;
+
+	if (!par->txbuf.buf || len < 2)
+		return;
+
+	start = ktime_get();
+	for (pass = 0; pass < 16; pass++) {
+		fbtft_convert_vmem16(par, par->txbuf.buf, vmem16, len / 2);
+		if (par->txbuf.streaming) {
+			dma_sync_single_for_device(dmadev, par->txbuf.dma,
+						len, DMA_TO_DEVICE);
+			dma_sync_single_for_cpu(dmadev, par->txbuf.dma,
+						len, DMA_TO_DEVICE);
+		}
+	}
+	ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+
+	dev_info(par->info->device,
+		"%s transmit buffer: %zu KiB converted in %llu us, %llu MB/s\n",
+		par->txbuf.streaming ? "streaming DMA" :
+		par->txbuf.dma ? "coherent DMA" : "cached",
+		16 * len >> 10, div_u64(ns, 1000),
+		div64_u64(16ULL * len * 1000, ns ? ns : 1));
+}
+
 /**
  * fbtft_framebuffer_alloc - creates a new frame buffer info structure
  *
@@ -699,6 +1608,9 @@ struct fb_info *fbtft_framebuffer_alloc(struct fbtft_display *display,
 	int *init_sequence = display->init_sequence;
 	char *gamma = display->gamma;
 	unsigned long *gamma_curves = NULL;
+	unsigned long *dirty_tiles, *dirty_pending;
+	struct fbtft_tile_span *dirty_spans;
+	unsigned dirty_cols, dirty_rows;
 
 	/* sanity check */
 	if (display->gamma_num * display->gamma_len > FBTFT_GAMMA_MAX_VALUES_TOTAL) {
@@ -740,6 +1652,12 @@ struct fb_info *fbtft_framebuffer_alloc(struct fbtft_display *display,
 		display->buswidth = pdata->display.buswidth;
 	if (pdata->display.regwidth)
 		display->regwidth = pdata->display.regwidth;
+	if (pdata->display.reg_speed_hz)
+		display->reg_speed_hz = pdata->display.reg_speed_hz;
+	if (pdata->display.pixel_speed_hz)
+		display->pixel_speed_hz = pdata->display.pixel_speed_hz;
+	if (pdata->display.read_speed_hz)
+		display->read_speed_hz = pdata->display.read_speed_hz;
 
 	display->debug |= debug;
 	fbtft_expand_debug_value(&display->debug);
@@ -756,7 +1674,10 @@ struct fb_info *fbtft_framebuffer_alloc(struct fbtft_display *display,
 	}
 
 	vmem_size = display->width * display->height * bpp / 8;
-	vmem = vzalloc(vmem_size);
+	if (dmavmem)
+		vmem = alloc_pages_exact(vmem_size, GFP_KERNEL | __GFP_ZERO);
+	if (!vmem)
+		vmem = vzalloc(vmem_size);
 	if (!vmem)
 		goto alloc_fail;
 
@@ -772,6 +1693,20 @@ struct fb_info *fbtft_framebuffer_alloc(struct fbtft_display *display,
 	if (!buf)
 		goto alloc_fail;
 
+	dirty_cols = DIV_ROUND_UP(width, FBTFT_TILE_WIDTH);
+	dirty_rows = DIV_ROUND_UP(height, FBTFT_TILE_HEIGHT);
+	dirty_tiles = devm_kzalloc(dev,
+		BITS_TO_LONGS(dirty_cols * dirty_rows) * sizeof(long),
+		GFP_KERNEL);
+	dirty_pending = devm_kzalloc(dev,
+		BITS_TO_LONGS(dirty_cols * dirty_rows) * sizeof(long),
+		GFP_KERNEL);
+	/* a row has at most (cols + 1) / 2 runs, room for two lists */
+	dirty_spans = devm_kzalloc(dev,
+		2 * dirty_cols * sizeof(struct fbtft_tile_span), GFP_KERNEL);
+	if (!dirty_tiles || !dirty_pending || !dirty_spans)
+		goto alloc_fail;
+
 	if (display->gamma_num && display->gamma_len) {
 		gamma_curves = devm_kzalloc(dev, display->gamma_num * display->gamma_len * sizeof(gamma_curves[0]),
 						GFP_KERNEL);
@@ -809,6 +1744,9 @@ struct fb_info *fbtft_framebuffer_alloc(struct fbtft_display *display,
 	info->fix.line_length =    width*bpp/8;
 	info->fix.accel =          FB_ACCEL_NONE;
 	info->fix.smem_len =       vmem_size;
+	/* fb_deferred_io uses smem_start to find non-vmalloc pages */
+	if (!is_vmalloc_addr(vmem))
+		info->fix.smem_start = virt_to_phys(vmem);
 
 	info->var.rotate =         pdata->rotate;
 	info->var.xres =           width;
@@ -832,17 +1770,38 @@ struct fb_info *fbtft_framebuffer_alloc(struct fbtft_display *display,
 
 	par = info->par;
 	par->info = info;
+	par->vmem = vmem;
 	par->pdata = dev->platform_data;
 	par->debug = display->debug;
 	par->buf = buf;
-	spin_lock_init(&par->dirty_lock);
+	par->dirty.tiles = dirty_tiles;
+	par->dirty.pending = dirty_pending;
+	par->dirty.open = dirty_spans;
+	par->dirty.next = dirty_spans + dirty_cols;
+	par->dirty.cols = dirty_cols;
+	par->dirty.rows = dirty_rows;
+	par->col_window = display->col_window;
+	par->big_endian = pdata->big_endian;
 	par->bgr = pdata->bgr;
 	par->startbyte = pdata->startbyte;
+	par->frame.fps = fps;
+	par->frame.period = div_u64(NSEC_PER_SEC, fps);
+	par->frame.min_fps = 1;
+	par->frame.max_fps = fps;
+	par->frame.policy = FBTFT_FRAME_LATENCY;
+	par->frame.leading_edge = pdata->leading_edge;
+	par->max_transfer = pdata->max_transfer;
+	par->speed_hz.reg = display->reg_speed_hz;
+	par->speed_hz.pixel = display->pixel_speed_hz;
+	par->speed_hz.read = display->read_speed_hz ? : FBTFT_READ_SPEED_HZ;
+	par->worker.rt_priority = pdata->rt_priority;
+	par->worker.cpu_affinity = pdata->cpu_affinity;
 	par->init_sequence = init_sequence;
 	par->gamma.curves = gamma_curves;
 	par->gamma.num_curves = display->gamma_num;
 	par->gamma.num_values = display->gamma_len;
 	mutex_init(&par->gamma.lock);
+	spin_lock_init(&par->frame.lock);
 	info->pseudo_palette = par->pseudo_palette;
 
 	if (par->gamma.curves && gamma) {
@@ -851,17 +1810,32 @@ struct fb_info *fbtft_framebuffer_alloc(struct fbtft_display *display,
 			goto alloc_fail;
 	}
 
+	/* big endian video memory needs a write_vmem() that knows about it */
+	if (par->big_endian && (bpp != 16 ||
+	    (display->buswidth != 8 && display->buswidth != 9) ||
+	    (display->fbtftops.write_vmem && !display->big_endian))) {
+		dev_warn(dev, "big endian video memory not supported\n");
+		par->big_endian = false;
+	}
+	if (par->big_endian)
+		info->var.nonstd |= FBTFT_NONSTD_BIG_ENDIAN;
+
 	/* Transmit buffer */
 	if (txbuflen == -1)
 		txbuflen = vmem_size + 2; /* add in case startbyte is used */
 
 #ifdef __LITTLE_ENDIAN
+	/*
+	 * Big endian video memory is only sent as is when it is DMA mapped.
+	 * The shadow and snapshot buffers are vmalloc'ed and can take its
+	 * place at any time, so it still needs a buffer to go through.
+	 */
 	if ((!txbuflen) && (bpp > 8))
 		txbuflen = PAGE_SIZE; /* need buffer for byteswapping */
 #endif
 
 	if (txbuflen > 0) {
-		if (dma) {
+		if (dma && !dmastream) {
 			dev->coherent_dma_mask = ~0;
 			txbuf = dmam_alloc_coherent(dev, txbuflen, &par->txbuf.dma, GFP_DMA);
 		} else {
@@ -871,8 +1845,17 @@ struct fb_info *fbtft_framebuffer_alloc(struct fbtft_display *display,
 			goto alloc_fail;
 		par->txbuf.buf = txbuf;
 		par->txbuf.len = txbuflen;
+		par->txbuf.streaming = dmastream;
 	}
 
+	for (i = 0; i < FBTFT_TX_SLOTS; i++)
+		init_completion(&par->pipeline.done[i]);
+	/* each slot needs room for the startbyte and a few pixels */
+	par->pipeline.enabled = pipeline &&
+				par->txbuf.len / FBTFT_TX_SLOTS >= 64;
+
+	fbtft_convert_init(par, convcpus ? convcpus : num_online_cpus());
+
 	/* Initialize gpios to disabled */
 	par->gpio.reset = -1;
 	par->gpio.dc = -1;
@@ -905,7 +1888,7 @@ struct fb_info *fbtft_framebuffer_alloc(struct fbtft_display *display,
 	return info;
 
 alloc_fail:
-	vfree(vmem);
+	fbtft_vmem_free(vmem, vmem_size);
 
 	return NULL;
 }
@@ -919,8 +1902,12 @@ EXPORT_SYMBOL(fbtft_framebuffer_alloc);
  */
 void fbtft_framebuffer_release(struct fb_info *info)
 {
+	struct fbtft_par *par = info->par;
+
 	fb_deferred_io_cleanup(info);
-	vfree(info->screen_base);
+	vfree(par->shadow.buf);
+	vfree(par->snapshot.buf);
+	fbtft_vmem_free((void __force *)info->screen_base, info->fix.smem_len);
 	framebuffer_release(info);
 }
 EXPORT_SYMBOL(fbtft_framebuffer_release);
@@ -941,7 +1928,7 @@ EXPORT_SYMBOL(fbtft_framebuffer_release);
 int fbtft_register_framebuffer(struct fb_info *fb_info)
 {
 	int ret;
-	char text1[50] = "";
+	char text1[80] = "";
 	char text2[50] = "";
 	struct fbtft_par *par = fb_info->par;
 	struct spi_device *spi = par->spi;
@@ -952,15 +1939,33 @@ int fbtft_register_framebuffer(struct fb_info *fb_info)
 		return -EINVAL;
 	}
 
+	/* the default set_addr_win() sets both column and row range */
+	if (par->fbtftops.set_addr_win == fbtft_set_addr_win)
+		par->col_window = true;
+
 	if (spi)
 		spi_set_drvdata(spi, fb_info);
 	if (par->pdev)
 		platform_set_drvdata(par->pdev, fb_info);
 
+	fbtft_dma_map(par);
+	fbtft_set_chunking(par);
+
+	/* partial width windows are collected here and sent in chunks */
+	if (par->col_window && par->txbuf.buf)
+		par->gather = devm_kzalloc(par->info->device, par->txbuf.len,
+								GFP_KERNEL);
+
+	if ((par->debug & DEBUG_TIME_FIRST_UPDATE) || par->txbuf.streaming)
+		fbtft_txbuf_benchmark(par);
+
 	ret = par->fbtftops.request_gpios(par);
 	if (ret < 0)
 		goto reg_fail;
 
+	if (par->pdev)
+		fbtft_gpio_bus_init(par);
+
 	if (par->fbtftops.verify_gpios) {
 		ret = par->fbtftops.verify_gpios(par);
 		if (ret < 0)
@@ -976,8 +1981,14 @@ int fbtft_register_framebuffer(struct fb_info *fb_info)
 			goto reg_fail;
 	}
 
+	if (calibrate && spi && !par->speed_hz.pixel)
+		fbtft_calibrate_speed(par);
+	if (autotune)
+		fbtft_autotune_chunk(par);
+
 	/* update the entire display */
-	par->fbtftops.update_display(par, 0, par->info->var.yres - 1);
+	par->fbtftops.update_display(par, 0, 0, par->info->var.xres - 1,
+					par->info->var.yres - 1);
 
 	if (par->fbtftops.set_gamma && par->gamma.curves) {
 		ret = par->fbtftops.set_gamma(par, par->gamma.curves);
@@ -992,19 +2003,24 @@ int fbtft_register_framebuffer(struct fb_info *fb_info)
 	if (ret < 0)
 		goto reg_fail;
 
+	fbtft_worker_start(par);
 	fbtft_sysfs_init(par);
 
 	if (par->txbuf.buf)
-		sprintf(text1, ", %d KiB %sbuffer memory",
-			par->txbuf.len >> 10, par->txbuf.dma ? "DMA " : "");
+		snprintf(text1, sizeof(text1),
+			", %d KiB %sbuffer memory, %zu byte chunks",
+			par->txbuf.len >> 10, par->txbuf.dma ? "DMA " : "",
+			par->txbuf.chunk);
+	else if (par->vmem_dma)
+		sprintf(text1, ", DMA video memory");
 	if (spi)
 		sprintf(text2, ", spi%d.%d at %d MHz", spi->master->bus_num,
 				spi->chip_select, spi->max_speed_hz/1000000);
 	dev_info(fb_info->dev,
-		"%s frame buffer, %dx%d, %d KiB video memory%s, fps=%lu%s\n",
+		"%s frame buffer, %dx%d, %d KiB video memory%s, fps=%u%s\n",
 		fb_info->fix.id, fb_info->var.xres, fb_info->var.yres,
 		fb_info->fix.smem_len >> 10, text1,
-		HZ/fb_info->fbdefio->delay, text2);
+		par->frame.fps, text2);
 
 #ifdef CONFIG_FB_BACKLIGHT
 	/* Turn on backlight if available */
@@ -1019,6 +2035,7 @@ int fbtft_register_framebuffer(struct fb_info *fb_info)
 reg_fail:
 	if (par->fbtftops.unregister_backlight)
 		par->fbtftops.unregister_backlight(par);
+	fbtft_dma_unmap(par);
 	if (spi)
 		spi_set_drvdata(spi, NULL);
 	if (par->pdev)
@@ -1050,7 +2067,10 @@ int fbtft_unregister_framebuffer(struct fb_info *fb_info)
 	if (par->fbtftops.unregister_backlight)
 		par->fbtftops.unregister_backlight(par);
 	fbtft_sysfs_exit(par);
+	cancel_delayed_work_sync(&fb_info->deferred_work);
+	fbtft_worker_stop(par);
 	ret = unregister_framebuffer(fb_info);
+	fbtft_dma_unmap(par);
 	return ret;
 }
 EXPORT_SYMBOL(fbtft_unregister_framebuffer);
@@ -1333,11 +2353,19 @@ static struct fbtft_platform_data *fbtft_probe_dt(struct device *dev)
 	pdata->display.backlight = fbtft_of_value(node, "backlight");
 	pdata->display.bpp = fbtft_of_value(node, "bpp");
 	pdata->display.debug = fbtft_of_value(node, "debug");
+	pdata->display.reg_speed_hz = fbtft_of_value(node, "reg-speed-hz");
+	pdata->display.pixel_speed_hz = fbtft_of_value(node, "pixel-speed-hz");
+	pdata->display.read_speed_hz = fbtft_of_value(node, "read-speed-hz");
 	pdata->rotate = fbtft_of_value(node, "rotate");
 	pdata->bgr = of_property_read_bool(node, "bgr");
 	pdata->fps = fbtft_of_value(node, "fps");
 	pdata->txbuflen = fbtft_of_value(node, "txbuflen");
 	pdata->startbyte = fbtft_of_value(node, "startbyte");
+	pdata->rt_priority = fbtft_of_value(node, "rt-priority");
+	pdata->cpu_affinity = fbtft_of_value(node, "cpu-affinity");
+	pdata->leading_edge = of_property_read_bool(node, "leading-edge");
+	pdata->max_transfer = fbtft_of_value(node, "max-transfer-size");
+	pdata->big_endian = of_property_read_bool(node, "vmem-big-endian");
 	of_property_read_string(node, "gamma", (const char **)&pdata->gamma);
 
 	if (of_find_property(node, "led-gpios", NULL))
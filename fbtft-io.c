@@ -1,19 +1,131 @@
 #include <linux/export.h>
 #include <linux/errno.h>
 #include <linux/gpio.h>
+#include <linux/gpio/consumer.h>
 #include <linux/spi/spi.h>
+#include <linux/dma-mapping.h>
 #ifdef CONFIG_ARCH_BCM2708
 #include <mach/platform.h>
 #endif
 #include "fbtft.h"
 
-int fbtft_write_spi(struct fbtft_par *par, void *buf, size_t len)
+/* Use the DMA mapping of the transmit buffer or video memory holding buf */
+static void fbtft_spi_dma_mapped(struct fbtft_par *par,
+				struct spi_transfer *t, struct spi_message *m)
+{
+	const u8 *buf = t->tx_buf;
+	const u8 *txbuf = par->txbuf.buf;
+	const u8 *vmem = (const u8 __force *)par->info->screen_base;
+
+	if (par->txbuf.dma && buf >= txbuf && buf < txbuf + par->txbuf.len) {
+		t->tx_dma = par->txbuf.dma + (buf - txbuf);
+		m->is_dma_mapped = 1;
+	} else if (par->vmem_dma && buf >= vmem &&
+			buf < vmem + par->info->fix.smem_len) {
+		t->tx_dma = par->vmem_dma + (buf - vmem);
+		m->is_dma_mapped = 1;
+	}
+}
+
+/* Streaming mappings must be synced before the controller reads them */
+static void fbtft_spi_dma_sync(struct fbtft_par *par,
+				struct spi_transfer *t, struct spi_message *m)
+{
+	const u8 *buf = t->tx_buf;
+	const u8 *txbuf = par->txbuf.buf;
+
+	if (!m->is_dma_mapped)
+		return;
+
+	/* the CPU writes to video memory all the time */
+	if (!(buf >= txbuf && buf < txbuf + par->txbuf.len) ||
+						par->txbuf.streaming)
+		dma_sync_single_for_device(par->spi->master->dev.parent,
+					t->tx_dma, t->len, DMA_TO_DEVICE);
+}
+
+/* Give a streaming transmit buffer back to the CPU after the transfer */
+static void fbtft_spi_dma_sync_for_cpu(struct fbtft_par *par,
+				struct spi_transfer *t, struct spi_message *m)
+{
+	const u8 *buf = t->tx_buf;
+	const u8 *txbuf = par->txbuf.buf;
+
+	if (m->is_dma_mapped && par->txbuf.streaming &&
+	    buf >= txbuf && buf < txbuf + par->txbuf.len)
+		dma_sync_single_for_cpu(par->spi->master->dev.parent,
+					t->tx_dma, t->len, DMA_TO_DEVICE);
+}
+
+/*
+ * Full frame writes and the chunks sent from txbuf use a message that is
+ * built once and reused for as long as the buffer, length and chunk size
+ * stay the same. All but the last chunk of an update have the same size.
+ */
+static int fbtft_write_spi_frame(struct fbtft_par *par, void *buf, size_t len)
+{
+	struct spi_transfer *t = par->frame_msg.t;
+	struct spi_message *m = &par->frame_msg.m;
+	size_t max = par->max_transfer ? par->max_transfer : len;
+	unsigned i, n = DIV_ROUND_UP(len, max);
+	u32 speed_hz = par->speed_hz.pixel;
+	int ret;
+
+	if (n > par->frame_msg.num_t)
+		return -EINVAL;
+
+	if (buf != par->frame_msg.buf || len != par->frame_msg.len ||
+	    speed_hz != par->frame_msg.speed_hz ||
+	    par->txbuf.chunk != par->frame_msg.chunk) {
+		memset(t, 0, n * sizeof(*t));
+		spi_message_init(m);
+		for (i = 0; i < n; i++) {
+			t[i].tx_buf = buf + i * max;
+			t[i].len = min(max, len - i * max);
+			t[i].speed_hz = speed_hz;
+			fbtft_spi_dma_mapped(par, &t[i], m);
+			spi_message_add_tail(&t[i], m);
+		}
+		par->frame_msg.buf = buf;
+		par->frame_msg.len = len;
+		par->frame_msg.speed_hz = speed_hz;
+		par->frame_msg.chunk = par->txbuf.chunk;
+	}
+
+	for (i = 0; i < n; i++)
+		fbtft_spi_dma_sync(par, &t[i], m);
+	ret = spi_sync(par->spi, m);
+	for (i = 0; i < n; i++)
+		fbtft_spi_dma_sync_for_cpu(par, &t[i], m);
+
+	return ret;
+}
+
+static int fbtft_write_spi_sync(struct fbtft_par *par, void *buf, size_t len)
 {
 	struct spi_transfer t = {
 		.tx_buf = buf,
 		.len = len,
+		/* register writes go through par->buf */
+		.speed_hz = buf == par->buf ? par->speed_hz.reg :
+					      par->speed_hz.pixel,
 	};
 	struct spi_message m;
+	int ret;
+
+	spi_message_init(&m);
+	fbtft_spi_dma_mapped(par, &t, &m);
+	fbtft_spi_dma_sync(par, &t, &m);
+	spi_message_add_tail(&t, &m);
+	ret = spi_sync(par->spi, &m);
+	fbtft_spi_dma_sync_for_cpu(par, &t, &m);
+
+	return ret;
+}
+
+int fbtft_write_spi(struct fbtft_par *par, void *buf, size_t len)
+{
+	int ret;
 
 	fbtft_par_dbg_hex(DEBUG_WRITE, par, par->info->device, u8, buf, len,
 		"%s(len=%d): ", __func__, len);
@@ -24,33 +136,115 @@ int fbtft_write_spi(struct fbtft_par *par, void *buf, size_t len)
 		return -1;
 	}
 
-	spi_message_init(&m);
-	if (par->txbuf.dma && buf == par->txbuf.buf) {
-		t.tx_dma = par->txbuf.dma;
-		m.is_dma_mapped = 1;
+	if (par->frame_msg.num_t && (len >= par->info->fix.smem_len ||
+	    (buf >= par->txbuf.buf && buf < par->txbuf.buf + par->txbuf.len)))
+		return fbtft_write_spi_frame(par, buf, len);
+
+	/* split what the controller can't take in one go */
+	while (par->max_transfer && len > par->max_transfer) {
+		ret = fbtft_write_spi_sync(par, buf, par->max_transfer);
+		if (ret < 0)
+			return ret;
+		buf += par->max_transfer;
+		len -= par->max_transfer;
 	}
-	spi_message_add_tail(&t, &m);
-	return spi_sync(par->spi, &m);
+
+	return fbtft_write_spi_sync(par, buf, len);
 }
 EXPORT_SYMBOL(fbtft_write_spi);
 
+static void fbtft_write_spi_complete(void *context)
+{
+	complete(context);
+}
+
+/**
+ * fbtft_write_spi_async() - start a SPI write without waiting for it
+ * @par: Driver data
+ * @slot: Pipeline slot, must not have a message in flight
+ * @buf: Buffer to write, must stay untouched until the slot is done
+ * @len: Length of buffer
+ *
+ * Messages are sent in the order they are submitted.
+ * Use fbtft_write_spi_wait() to wait for the slot to complete.
+ */
+int fbtft_write_spi_async(struct fbtft_par *par, unsigned slot,
+						void *buf, size_t len)
+{
+	struct spi_transfer *t = &par->pipeline.t[slot];
+	struct spi_message *m = &par->pipeline.m[slot];
+	int ret;
+
+	fbtft_par_dbg_hex(DEBUG_WRITE, par, par->info->device, u8, buf, len,
+		"%s(slot=%u, len=%d): ", __func__, slot, len);
+
+	if (!par->spi) {
+		dev_err(par->info->device,
+			"%s: par->spi is unexpectedly NULL\n", __func__);
+		return -1;
+	}
+
+	memset(t, 0, sizeof(*t));
+	t->tx_buf = buf;
+	t->len = len;
+	t->speed_hz = par->speed_hz.pixel;
+	spi_message_init(m);
+	fbtft_spi_dma_mapped(par, t, m);
+	fbtft_spi_dma_sync(par, t, m);
+	spi_message_add_tail(t, m);
+	m->complete = fbtft_write_spi_complete;
+	m->context = &par->pipeline.done[slot];
+
+	reinit_completion(&par->pipeline.done[slot]);
+	par->pipeline.pending[slot] = true;
+	ret = spi_async(par->spi, m);
+	if (ret)
+		par->pipeline.pending[slot] = false;
+
+	return ret;
+}
+EXPORT_SYMBOL(fbtft_write_spi_async);
+
+/**
+ * fbtft_write_spi_wait() - wait for an asynchronous SPI write
+ * @par: Driver data
+ * @slot: Pipeline slot
+ *
+ * Return: status of the message, 0 if nothing was in flight
+ */
+int fbtft_write_spi_wait(struct fbtft_par *par, unsigned slot)
+{
+	if (!par->pipeline.pending[slot])
+		return 0;
+
+	wait_for_completion(&par->pipeline.done[slot]);
+	par->pipeline.pending[slot] = false;
+	fbtft_spi_dma_sync_for_cpu(par, &par->pipeline.t[slot],
+					&par->pipeline.m[slot]);
+
+	return par->pipeline.m[slot].status;
+}
+EXPORT_SYMBOL(fbtft_write_spi_wait);
+
 /**
  * fbtft_write_spi_emulate_9() - write SPI emulating 9-bit
  * @par: Driver data
  * @buf: Buffer to write
- * @len: Length of buffer (must be divisible by 8)
+ * @len: Length of buffer
  *
  * When 9-bit SPI is not available, this function can be used to emulate that.
  * par->extra must hold a transformation buffer used for transfer.
+ * fbtft_write_vmem16_bus9() packs pixels into par->extra itself.
  */
 int fbtft_write_spi_emulate_9(struct fbtft_par *par, void *buf, size_t len)
 {
-	u16 *src = buf;
-	u8 *dst = par->extra;
-	size_t size = len / 2;
-	size_t added = 0;
-	int bits, i, j;
-	u64 val, dc, tmp;
+	struct spi_transfer t = {
+		.tx_buf = par->extra,
+		/* register writes go through par->buf */
+		.speed_hz = buf == par->buf ? par->speed_hz.reg :
+					      par->speed_hz.pixel,
+	};
+	struct spi_message m;
 
 	fbtft_par_dbg_hex(DEBUG_WRITE, par, par->info->device, u8, buf, len,
 		"%s(len=%d): ", __func__, len);
@@ -60,32 +254,11 @@ int fbtft_write_spi_emulate_9(struct fbtft_par *par, void *buf, size_t len)
 			__func__);
 		return -EINVAL;
 	}
-	if ((len % 8) != 0) {
-		dev_err(par->info->device,
-			"%s: error: len=%d must be divisible by 8\n",
-			__func__, len);
-		return -EINVAL;
-	}
 
-	for (i = 0; i < size; i += 8) {
-		tmp = 0;
-		bits = 63;
-		for (j = 0; j < 7; j++) {
-			dc = (*src & 0x0100) ? 1 : 0;
-			val = *src & 0x00FF;
-			tmp |= dc << bits;
-			bits -= 8;
-			tmp |= val << bits--;
-			src++;
-		}
-		tmp |= ((*src & 0x0100) ? 1 : 0);
-		*(u64 *)dst = cpu_to_be64(tmp);
-		dst += 8;
-		*dst++ = (u8)(*src++ & 0x00FF);
-		added++;
-	}
-
-	return spi_write(par->spi, par->extra, size + added);
+	t.len = fbtft_pack9(par->extra, buf, len / 2);
+	spi_message_init(&m);
+	spi_message_add_tail(&t, &m);
+	return spi_sync(par->spi, &m);
 }
 EXPORT_SYMBOL(fbtft_write_spi_emulate_9);
 
@@ -94,7 +267,7 @@ int fbtft_read_spi(struct fbtft_par *par, void *buf, size_t len)
 	int ret;
 	u8 txbuf[32] = { 0, };
 	struct spi_transfer	t = {
-			.speed_hz = 2000000,
+			.speed_hz = par->speed_hz.read,
 			.rx_buf		= buf,
 			.len		= len,
 		};
@@ -129,6 +302,62 @@ int fbtft_read_spi(struct fbtft_par *par, void *buf, size_t len)
 }
 EXPORT_SYMBOL(fbtft_read_spi);
 
+/**
+ * fbtft_gpio_bus_init() - Look up the parallel bus lines once
+ * @par: Driver data
+ *
+ * The gpiolib bus writers use the descriptors instead of translating
+ * GPIO numbers for every line of every byte.
+ */
+void fbtft_gpio_bus_init(struct fbtft_par *par)
+{
+	int i;
+
+	for (i = 0; i < 16; i++)
+		par->pbus.db[i] = par->gpio.db[i] < 0 ? NULL :
+					gpio_to_desc(par->gpio.db[i]);
+	par->pbus.wr = par->gpio.wr < 0 ? NULL : gpio_to_desc(par->gpio.wr);
+	par->pbus.latch = par->gpio.latch < 0 ? NULL :
+					gpio_to_desc(par->gpio.latch);
+	/* the state of the data lines is unknown */
+	par->pbus.valid = false;
+}
+EXPORT_SYMBOL(fbtft_gpio_bus_init);
+
+/**
+ * fbtft_gpio_bus_set() - Put a value on the parallel databus
+ * @par: Driver data
+ * @data: Value to put on the bus
+ * @mask: Data lines that are part of the bus
+ *
+ * Only the lines that differ from the previous value are touched.
+ *
+ * Return: the number of lines changed
+ */
+unsigned fbtft_gpio_bus_set(struct fbtft_par *par, unsigned data,
+				unsigned mask)
+{
+	unsigned changed = mask;
+	unsigned i, n = 0;
+
+#ifndef DO_NOT_OPTIMIZE_FBTFT_WRITE_GPIO
+	if (par->pbus.valid)
+		changed &= data ^ par->pbus.prev;
+#endif
+	par->pbus.prev = (par->pbus.prev & ~mask) | (data & mask);
+	par->pbus.valid = true;
+
+	while (changed) {
+		i = __ffs(changed);
+		gpiod_set_raw_value(par->pbus.db[i], (data >> i) & 1);
+		changed &= changed - 1;
+		n++;
+	}
+
+	return n;
+}
+EXPORT_SYMBOL(fbtft_gpio_bus_set);
+
 
 #ifdef CONFIG_ARCH_BCM2708
 
@@ -294,54 +523,23 @@ EXPORT_SYMBOL(fbtft_write_gpio16_wr_latched);
 
 #else
 
-/*
- * Optimized use of gpiolib is twice as fast as no optimization
- * only one driver can use the optimized version at a time
- */
 int fbtft_write_gpio8_wr(struct fbtft_par *par, void *buf, size_t len)
 {
-	u8 data;
-	int i;
-#ifndef DO_NOT_OPTIMIZE_FBTFT_WRITE_GPIO
-	static u8 prev_data;
-#endif
+	u8 *data = buf;
 
 	fbtft_par_dbg_hex(DEBUG_WRITE, par, par->info->device, u8, buf, len,
 		"%s(len=%d): ", __func__, len);
 
 	while (len--) {
-		data = *(u8 *) buf;
-
 		/* Start writing by pulling down /WR */
-		gpio_set_value(par->gpio.wr, 0);
+		gpiod_set_raw_value(par->pbus.wr, 0);
 
 		/* Set data */
-#ifndef DO_NOT_OPTIMIZE_FBTFT_WRITE_GPIO
-		if (data == prev_data) {
-			gpio_set_value(par->gpio.wr, 0); /* used as delay */
-		} else {
-			for (i = 0; i < 8; i++) {
-				if ((data & 1) != (prev_data & 1))
-					gpio_set_value(par->gpio.db[i],
-								(data & 1));
-				data >>= 1;
-				prev_data >>= 1;
-			}
-		}
-#else
-		for (i = 0; i < 8; i++) {
-			gpio_set_value(par->gpio.db[i], (data & 1));
-			data >>= 1;
-		}
-#endif
+		if (!fbtft_gpio_bus_set(par, *data++, 0x00FF))
+			gpiod_set_raw_value(par->pbus.wr, 0); /* used as delay */
 
 		/* Pullup /WR */
-		gpio_set_value(par->gpio.wr, 1);
-
-#ifndef DO_NOT_OPTIMIZE_FBTFT_WRITE_GPIO
-		prev_data = *(u8 *) buf;
-#endif
-		buf++;
+		gpiod_set_raw_value(par->pbus.wr, 1);
 	}
 
 	return 0;
@@ -350,48 +548,21 @@ EXPORT_SYMBOL(fbtft_write_gpio8_wr);
 
 int fbtft_write_gpio16_wr(struct fbtft_par *par, void *buf, size_t len)
 {
-	u16 data;
-	int i;
-#ifndef DO_NOT_OPTIMIZE_FBTFT_WRITE_GPIO
-	static u16 prev_data;
-#endif
+	u16 *data = buf;
 
 	fbtft_par_dbg_hex(DEBUG_WRITE, par, par->info->device, u8, buf, len,
 		"%s(len=%d): ", __func__, len);
 
-	while (len) {
-		data = *(u16 *) buf;
-
+	while (len >= 2) {
 		/* Start writing by pulling down /WR */
-		gpio_set_value(par->gpio.wr, 0);
+		gpiod_set_raw_value(par->pbus.wr, 0);
 
 		/* Set data */
-#ifndef DO_NOT_OPTIMIZE_FBTFT_WRITE_GPIO
-		if (data == prev_data) {
-			gpio_set_value(par->gpio.wr, 0); /* used as delay */
-		} else {
-			for (i = 0; i < 16; i++) {
-				if ((data & 1) != (prev_data & 1))
-					gpio_set_value(par->gpio.db[i],
-								(data & 1));
-				data >>= 1;
-				prev_data >>= 1;
-			}
-		}
-#else
-		for (i = 0; i < 16; i++) {
-			gpio_set_value(par->gpio.db[i], (data & 1));
-			data >>= 1;
-		}
-#endif
+		if (!fbtft_gpio_bus_set(par, *data++, 0xFFFF))
+			gpiod_set_raw_value(par->pbus.wr, 0); /* used as delay */
 
 		/* Pullup /WR */
-		gpio_set_value(par->gpio.wr, 1);
-
-#ifndef DO_NOT_OPTIMIZE_FBTFT_WRITE_GPIO
-		prev_data = *(u16 *) buf;
-#endif
-		buf += 2;
+		gpiod_set_raw_value(par->pbus.wr, 1);
 		len -= 2;
 	}
 
@@ -401,8 +572,31 @@ EXPORT_SYMBOL(fbtft_write_gpio16_wr);
 
 int fbtft_write_gpio16_wr_latched(struct fbtft_par *par, void *buf, size_t len)
 {
-	dev_err(par->info->device, "%s: function not implemented\n", __func__);
-	return -1;
+	u16 *data = buf;
+
+	fbtft_par_dbg_hex(DEBUG_WRITE, par, par->info->device, u8, buf, len,
+		"%s(len=%d): ", __func__, len);
+
+	while (len >= 2) {
+		/* Start writing by pulling down /WR */
+		gpiod_set_raw_value(par->pbus.wr, 0);
+
+		/* Low byte */
+		fbtft_gpio_bus_set(par, *data & 0x00FF, 0x00FF);
+
+		/* Pulse 'latch' high */
+		gpiod_set_raw_value(par->pbus.latch, 1);
+		gpiod_set_raw_value(par->pbus.latch, 0);
+
+		/* High byte */
+		fbtft_gpio_bus_set(par, *data++ >> 8, 0x00FF);
+
+		/* Pullup /WR */
+		gpiod_set_raw_value(par->pbus.wr, 1);
+		len -= 2;
+	}
+
+	return 0;
 }
 EXPORT_SYMBOL(fbtft_write_gpio16_wr_latched);
 
@@ -1,6 +1,7 @@
+#include <linux/vmalloc.h>
+#include <linux/math64.h>
 #include "fbtft.h"
 
-
 static int get_next_ulong(char **str_p, unsigned long *val, char *sep, int base)
 {
 	char *p_val;
@@ -206,17 +207,421 @@ static ssize_t show_debug(struct device *device,
 static struct device_attribute debug_device_attr = \
 	__ATTR(debug, 0660, show_debug, store_debug);
 
+static ssize_t store_shadow(struct device *device,
+				struct device_attribute *attr,
+				const char *buf, size_t count)
+{
+	struct fb_info *fb_info = dev_get_drvdata(device);
+	struct fbtft_par *par = fb_info->par;
+	bool enable;
+	int ret;
+
+	ret = strtobool(buf, &enable);
+	if (ret)
+		return ret;
+
+	if (enable && !par->shadow.enabled) {
+		if (!par->shadow.buf) {
+			par->shadow.buf = vzalloc(fb_info->fix.smem_len);
+			if (!par->shadow.buf)
+				return -ENOMEM;
+		}
+		/* the display content is unknown, start with a full update */
+		par->shadow.sync = true;
+		/* buf and sync before enabled, the update worker may be running */
+		smp_wmb();
+		par->shadow.enabled = true;
+		par->fbtftops.mkdirty(fb_info, -1, -1, 0, 0);
+	} else if (!enable) {
+		par->shadow.enabled = false;
+	}
+
+	return count;
+}
+
+static ssize_t show_shadow(struct device *device,
+				struct device_attribute *attr, char *buf)
+{
+	struct fb_info *fb_info = dev_get_drvdata(device);
+	struct fbtft_par *par = fb_info->par;
+
+	return snprintf(buf, PAGE_SIZE, "%d\n", par->shadow.enabled);
+}
+
+static ssize_t show_shadow_bytes_saved(struct device *device,
+				struct device_attribute *attr, char *buf)
+{
+	struct fb_info *fb_info = dev_get_drvdata(device);
+	struct fbtft_par *par = fb_info->par;
+
+	return snprintf(buf, PAGE_SIZE, "%llu\n", par->shadow.bytes_saved);
+}
+
+static ssize_t show_shadow_tiles_skipped(struct device *device,
+				struct device_attribute *attr, char *buf)
+{
+	struct fb_info *fb_info = dev_get_drvdata(device);
+	struct fbtft_par *par = fb_info->par;
+
+	return snprintf(buf, PAGE_SIZE, "%lu\n", par->shadow.tiles_skipped);
+}
+
+static struct device_attribute shadow_device_attrs[] = {
+	__ATTR(shadow, 0660, show_shadow, store_shadow),
+	__ATTR(shadow_bytes_saved, 0440, show_shadow_bytes_saved, NULL),
+	__ATTR(shadow_tiles_skipped, 0440, show_shadow_tiles_skipped, NULL),
+};
+
+static ssize_t store_snapshot(struct device *device,
+				struct device_attribute *attr,
+				const char *buf, size_t count)
+{
+	struct fb_info *fb_info = dev_get_drvdata(device);
+	struct fbtft_par *par = fb_info->par;
+	bool enable;
+	int ret;
+
+	ret = strtobool(buf, &enable);
+	if (ret)
+		return ret;
+
+	if (enable && !par->snapshot.buf) {
+		par->snapshot.buf = vzalloc(fb_info->fix.smem_len);
+		if (!par->snapshot.buf)
+			return -ENOMEM;
+	}
+	/*
+	 * The deferred io worker switches buffers on the next update,
+	 * buf before enabled, the worker may be running.
+	 */
+	smp_wmb();
+	par->snapshot.enabled = enable;
+
+	return count;
+}
+
+static ssize_t show_snapshot(struct device *device,
+				struct device_attribute *attr, char *buf)
+{
+	struct fb_info *fb_info = dev_get_drvdata(device);
+	struct fbtft_par *par = fb_info->par;
+
+	return snprintf(buf, PAGE_SIZE, "%d\n", par->snapshot.enabled);
+}
+
+static struct device_attribute snapshot_device_attr = \
+	__ATTR(snapshot, 0660, show_snapshot, store_snapshot);
+
+static ssize_t store_rt_priority(struct device *device,
+				struct device_attribute *attr,
+				const char *buf, size_t count)
+{
+	struct fb_info *fb_info = dev_get_drvdata(device);
+	struct fbtft_par *par = fb_info->par;
+	unsigned int val, old;
+	int ret;
+
+	ret = kstrtouint(buf, 10, &val);
+	if (ret)
+		return ret;
+
+	old = par->worker.rt_priority;
+	par->worker.rt_priority = val;
+	ret = fbtft_worker_set_sched(par);
+	if (ret) {
+		par->worker.rt_priority = old;
+		fbtft_worker_set_sched(par);
+		return ret;
+	}
+
+	return count;
+}
+
+static ssize_t show_rt_priority(struct device *device,
+				struct device_attribute *attr, char *buf)
+{
+	struct fb_info *fb_info = dev_get_drvdata(device);
+	struct fbtft_par *par = fb_info->par;
+
+	return snprintf(buf, PAGE_SIZE, "%u\n", par->worker.rt_priority);
+}
+
+static ssize_t store_cpu_affinity(struct device *device,
+				struct device_attribute *attr,
+				const char *buf, size_t count)
+{
+	struct fb_info *fb_info = dev_get_drvdata(device);
+	struct fbtft_par *par = fb_info->par;
+	unsigned long val, old;
+	int ret;
+
+	ret = kstrtoul(buf, 16, &val);
+	if (ret)
+		return ret;
+
+	old = par->worker.cpu_affinity;
+	par->worker.cpu_affinity = val;
+	ret = fbtft_worker_set_sched(par);
+	if (ret) {
+		par->worker.cpu_affinity = old;
+		fbtft_worker_set_sched(par);
+		return ret;
+	}
+
+	return count;
+}
+
+static ssize_t show_cpu_affinity(struct device *device,
+				struct device_attribute *attr, char *buf)
+{
+	struct fb_info *fb_info = dev_get_drvdata(device);
+	struct fbtft_par *par = fb_info->par;
+
+	return snprintf(buf, PAGE_SIZE, "%lx\n", par->worker.cpu_affinity);
+}
+
+static struct device_attribute worker_device_attrs[] = {
+	__ATTR(rt_priority, 0660, show_rt_priority, store_rt_priority),
+	__ATTR(cpu_affinity, 0660, show_cpu_affinity, store_cpu_affinity),
+};
+
+static ssize_t store_fps_range(struct device *device,
+				struct device_attribute *attr,
+				const char *buf, size_t count)
+{
+	struct fb_info *fb_info = dev_get_drvdata(device);
+	struct fbtft_par *par = fb_info->par;
+	unsigned int val;
+	int ret;
+
+	ret = kstrtouint(buf, 10, &val);
+	if (ret)
+		return ret;
+	if (!val)
+		return -EINVAL;
+
+	if (!strcmp(attr->attr.name, "fps_min"))
+		par->frame.min_fps = val;
+	else
+		par->frame.max_fps = val;
+
+	return count;
+}
+
+static ssize_t show_fps_range(struct device *device,
+				struct device_attribute *attr, char *buf)
+{
+	struct fb_info *fb_info = dev_get_drvdata(device);
+	struct fbtft_par *par = fb_info->par;
+
+	return snprintf(buf, PAGE_SIZE, "%u\n",
+		!strcmp(attr->attr.name, "fps_min") ? par->frame.min_fps :
+						      par->frame.max_fps);
+}
+
+static const char * const frame_policy_names[] = {
+	[FBTFT_FRAME_LATENCY] = "latency",
+	[FBTFT_FRAME_THROUGHPUT] = "throughput",
+	[FBTFT_FRAME_POWER] = "power",
+};
+
+static ssize_t store_frame_policy(struct device *device,
+				struct device_attribute *attr,
+				const char *buf, size_t count)
+{
+	struct fb_info *fb_info = dev_get_drvdata(device);
+	struct fbtft_par *par = fb_info->par;
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(frame_policy_names); i++) {
+		if (sysfs_streq(buf, frame_policy_names[i])) {
+			par->frame.policy = i;
+			return count;
+		}
+	}
+
+	return -EINVAL;
+}
+
+static ssize_t show_frame_policy(struct device *device,
+				struct device_attribute *attr, char *buf)
+{
+	struct fb_info *fb_info = dev_get_drvdata(device);
+	struct fbtft_par *par = fb_info->par;
+
+	return snprintf(buf, PAGE_SIZE, "%s\n",
+				frame_policy_names[par->frame.policy]);
+}
+
+static ssize_t show_frame_stats(struct device *device,
+				struct device_attribute *attr, char *buf)
+{
+	struct fb_info *fb_info = dev_get_drvdata(device);
+	struct fbtft_par *par = fb_info->par;
+
+	if (!strcmp(attr->attr.name, "frame_updates"))
+		return snprintf(buf, PAGE_SIZE, "%lu\n", par->frame.updates);
+	if (!strcmp(attr->attr.name, "frame_coalesced"))
+		return snprintf(buf, PAGE_SIZE, "%lu\n", par->frame.coalesced);
+	if (!strcmp(attr->attr.name, "frame_dropped"))
+		return snprintf(buf, PAGE_SIZE, "%lu\n", par->frame.dropped);
+
+	/* update_time in microseconds */
+	return snprintf(buf, PAGE_SIZE, "%llu\n",
+			div_u64(par->frame.update_time, NSEC_PER_USEC));
+}
+
+static ssize_t store_leading_edge(struct device *device,
+				struct device_attribute *attr,
+				const char *buf, size_t count)
+{
+	struct fb_info *fb_info = dev_get_drvdata(device);
+	struct fbtft_par *par = fb_info->par;
+	bool enable;
+	int ret;
+
+	ret = strtobool(buf, &enable);
+	if (ret)
+		return ret;
+	par->frame.leading_edge = enable;
+
+	return count;
+}
+
+static ssize_t show_leading_edge(struct device *device,
+				struct device_attribute *attr, char *buf)
+{
+	struct fb_info *fb_info = dev_get_drvdata(device);
+	struct fbtft_par *par = fb_info->par;
+
+	return snprintf(buf, PAGE_SIZE, "%d\n", par->frame.leading_edge);
+}
+
+static struct device_attribute frame_device_attrs[] = {
+	__ATTR(fps_min, 0660, show_fps_range, store_fps_range),
+	__ATTR(fps_max, 0660, show_fps_range, store_fps_range),
+	__ATTR(frame_policy, 0660, show_frame_policy, store_frame_policy),
+	__ATTR(leading_edge, 0660, show_leading_edge, store_leading_edge),
+	__ATTR(frame_updates, 0440, show_frame_stats, NULL),
+	__ATTR(frame_coalesced, 0440, show_frame_stats, NULL),
+	__ATTR(frame_dropped, 0440, show_frame_stats, NULL),
+	__ATTR(update_time, 0440, show_frame_stats, NULL),
+};
+
+static u32 *speed_hz_of_attr(struct fbtft_par *par,
+				struct device_attribute *attr)
+{
+	if (!strcmp(attr->attr.name, "reg_speed_hz"))
+		return &par->speed_hz.reg;
+	if (!strcmp(attr->attr.name, "pixel_speed_hz"))
+		return &par->speed_hz.pixel;
+	return &par->speed_hz.read;
+}
+
+static ssize_t store_speed_hz(struct device *device,
+				struct device_attribute *attr,
+				const char *buf, size_t count)
+{
+	struct fb_info *fb_info = dev_get_drvdata(device);
+	struct fbtft_par *par = fb_info->par;
+	u32 *speed_hz = speed_hz_of_attr(par, attr);
+	u32 max = par->spi->master->max_speed_hz;
+	u32 val;
+	int ret;
+
+	ret = kstrtou32(buf, 10, &val);
+	if (ret)
+		return ret;
+	/*
+	 * Calibration may have set a clock above the device speed, so only
+	 * the controller limits it. 0 restores the default.
+	 */
+	if (max && val > max)
+		return -EINVAL;
+	if (!val && speed_hz == &par->speed_hz.read)
+		val = FBTFT_READ_SPEED_HZ;
+
+	*speed_hz = val;
+
+	return count;
+}
+
+static ssize_t show_speed_hz(struct device *device,
+				struct device_attribute *attr, char *buf)
+{
+	struct fb_info *fb_info = dev_get_drvdata(device);
+	struct fbtft_par *par = fb_info->par;
+
+	return snprintf(buf, PAGE_SIZE, "%u\n", *speed_hz_of_attr(par, attr));
+}
+
+static struct device_attribute speed_device_attrs[] = {
+	__ATTR(reg_speed_hz, 0660, show_speed_hz, store_speed_hz),
+	__ATTR(pixel_speed_hz, 0660, show_speed_hz, store_speed_hz),
+	__ATTR(read_speed_hz, 0660, show_speed_hz, store_speed_hz),
+};
+
+static ssize_t show_chunk_table(struct device *device,
+				struct device_attribute *attr, char *buf)
+{
+	struct fb_info *fb_info = dev_get_drvdata(device);
+	struct fbtft_par *par = fb_info->par;
+	ssize_t len = 0;
+	unsigned i;
+
+	for (i = 0; i < par->autotune.num; i++)
+		len += scnprintf(buf + len, PAGE_SIZE - len, "%zu %u%s\n",
+				par->autotune.chunk[i], par->autotune.us[i],
+				i == par->autotune.best ? " *" : "");
+
+	return len;
+}
+
+static struct device_attribute chunk_table_device_attr = \
+	__ATTR(chunk_table, 0440, show_chunk_table, NULL);
 
 void fbtft_sysfs_init(struct fbtft_par *par)
 {
+	int i;
+
 	device_create_file(par->info->dev, &debug_device_attr);
+	for (i = 0; i < ARRAY_SIZE(shadow_device_attrs); i++)
+		device_create_file(par->info->dev, &shadow_device_attrs[i]);
+	device_create_file(par->info->dev, &snapshot_device_attr);
+	if (par->worker.task) {
+		for (i = 0; i < ARRAY_SIZE(worker_device_attrs); i++)
+			device_create_file(par->info->dev,
+						&worker_device_attrs[i]);
+		for (i = 0; i < ARRAY_SIZE(frame_device_attrs); i++)
+			device_create_file(par->info->dev,
+						&frame_device_attrs[i]);
+	}
+	if (par->spi)
+		for (i = 0; i < ARRAY_SIZE(speed_device_attrs); i++)
+			device_create_file(par->info->dev,
+						&speed_device_attrs[i]);
+	if (par->autotune.num)
+		device_create_file(par->info->dev, &chunk_table_device_attr);
 	if (par->gamma.curves && par->fbtftops.set_gamma)
 		device_create_file(par->info->dev, &gamma_device_attrs[0]);
 }
 
 void fbtft_sysfs_exit(struct fbtft_par *par)
 {
+	int i;
+
 	device_remove_file(par->info->dev, &debug_device_attr);
+	for (i = 0; i < ARRAY_SIZE(shadow_device_attrs); i++)
+		device_remove_file(par->info->dev, &shadow_device_attrs[i]);
+	device_remove_file(par->info->dev, &snapshot_device_attr);
+	for (i = 0; i < ARRAY_SIZE(worker_device_attrs); i++)
+		device_remove_file(par->info->dev, &worker_device_attrs[i]);
+	for (i = 0; i < ARRAY_SIZE(frame_device_attrs); i++)
+		device_remove_file(par->info->dev, &frame_device_attrs[i]);
+	for (i = 0; i < ARRAY_SIZE(speed_device_attrs); i++)
+		device_remove_file(par->info->dev, &speed_device_attrs[i]);
+	if (par->autotune.num)
+		device_remove_file(par->info->dev, &chunk_table_device_attr);
 	if (par->gamma.curves && par->fbtftops.set_gamma)
 		device_remove_file(par->info->dev, &gamma_device_attrs[0]);
 }
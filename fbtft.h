@@ -20,6 +20,11 @@
 #define __LINUX_FBTFT_H
 
 #include <linux/fb.h>
+#include <linux/gpio/consumer.h>
+#include <linux/completion.h>
+#include <linux/hrtimer.h>
+#include <linux/kthread.h>
+#include <linux/workqueue.h>
 #include <linux/spinlock.h>
 #include <linux/spi/spi.h>
 #include <linux/platform_device.h>
@@ -32,6 +37,7 @@
 #define FBTFT_CASET		0x2A
 #define FBTFT_RASET		0x2B
 #define FBTFT_RAMWR		0x2C
+#define FBTFT_RAMRD		0x2E
 
 #define FBTFT_ONBOARD_BACKLIGHT 2
 
@@ -43,6 +49,37 @@
 #define FBTFT_OF_INIT_CMD	BIT(24)
 #define FBTFT_OF_INIT_DELAY	BIT(25)
 
+/* number of txbuf slots in flight when pipelining SPI transfers */
+#define FBTFT_TX_SLOTS		2
+
+/* damage tracking granularity in pixels */
+#define FBTFT_TILE_WIDTH	16
+#define FBTFT_TILE_HEIGHT	16
+
+/* pixel conversion is split over at most this many CPUs */
+#define FBTFT_CONVERT_BANDS	4
+/*
+ * Smallest band in pixels worth handing to another CPU. Swapping 4096
+ * pixels takes well under a microsecond, waking an unbound worker and
+ * flushing it takes tens of microseconds.
+ */
+#define FBTFT_CONVERT_MIN_BAND	65536
+
+/* pixels written and read back per step by the calibrate module parameter */
+#define FBTFT_CALIBRATE_PIXELS	64
+#define FBTFT_CALIBRATE_STEPS	16
+
+/* SPI clock for reads if the display doesn't set read_speed_hz */
+#define FBTFT_READ_SPEED_HZ	2000000
+
+/* number of chunk sizes tried by the autotune module parameter */
+#define FBTFT_AUTOTUNE_STEPS	8
+/* full frame updates timed per chunk size, the fastest one counts */
+#define FBTFT_AUTOTUNE_RUNS	4
+
+/* var.nonstd: video memory holds big endian RGB565 (panel native order) */
+#define FBTFT_NONSTD_BIG_ENDIAN	BIT(1)
+
 /**
  * struct fbtft_gpio - Structure that holds one pinname to gpio mapping
  * @name: pinname (reset, dc, etc.)
@@ -56,6 +93,22 @@ struct fbtft_gpio {
 
 struct fbtft_par;
 
+/**
+ * struct fbtft_convert_band - Part of a pixel conversion run on another CPU
+ * @work: Work item converting the band
+ * @par: Driver data
+ * @dst: Destination buffer
+ * @src: Video memory
+ * @count: Number of pixels
+ */
+struct fbtft_convert_band {
+	struct work_struct work;
+	struct fbtft_par *par;
+	void *dst;
+	const u16 *src;
+	size_t count;
+};
+
 /**
  * struct fbtft_ops - FBTFT operations structure
  * @write: Writes to interface bus
@@ -64,8 +117,8 @@ struct fbtft_par;
  * @write_reg: Writes to controller register
  * @set_addr_win: Set the GRAM update window
  * @reset: Reset the LCD controller
- * @mkdirty: Marks display lines for update
- * @update_display: Updates the display
+ * @mkdirty: Marks display area for update
+ * @update_display: Updates the display area
  * @init_display: Initializes the display
  * @blank: Blank the display (optional)
  * @request_gpios_match: Do pinname to gpio matching
@@ -90,9 +143,10 @@ struct fbtft_ops {
 	void (*set_addr_win)(struct fbtft_par *par,
 		int xs, int ys, int xe, int ye);
 	void (*reset)(struct fbtft_par *par);
-	void (*mkdirty)(struct fb_info *info, int from, int to);
+	void (*mkdirty)(struct fb_info *info, int x, int y,
+				int width, int height);
 	void (*update_display)(struct fbtft_par *par,
-				unsigned start_line, unsigned end_line);
+				unsigned xs, unsigned ys, unsigned xe, unsigned ye);
 	int (*init_display)(struct fbtft_par *par);
 	int (*blank)(struct fbtft_par *par, bool on);
 
@@ -108,6 +162,32 @@ struct fbtft_ops {
 	int (*set_gamma)(struct fbtft_par *par, unsigned long *curves);
 };
 
+/**
+ * enum fbtft_frame_policy - How the frame rate adapts to the update time
+ * @FBTFT_FRAME_LATENCY: Bus can be busy all the time, update as soon as
+ *                       possible
+ * @FBTFT_FRAME_THROUGHPUT: Keep the bus busy at most 75% of the time,
+ *                          coalescing more damage per update
+ * @FBTFT_FRAME_POWER: Keep the bus busy at most 25% of the time
+ */
+enum fbtft_frame_policy {
+	FBTFT_FRAME_LATENCY,
+	FBTFT_FRAME_THROUGHPUT,
+	FBTFT_FRAME_POWER,
+};
+
+/**
+ * struct fbtft_tile_span - Dirty tile run used when merging damage
+ * @xs: First tile column
+ * @xe: Last tile column
+ * @ys: First tile row
+ */
+struct fbtft_tile_span {
+	unsigned xs;
+	unsigned xe;
+	unsigned ys;
+};
+
 /**
  * struct fbtft_display - Describes the display properties
  * @width: Width of display in pixels
@@ -119,6 +199,12 @@ struct fbtft_ops {
  * @bpp: Bits per pixel
  * @fps: Frames per second
  * @txbuflen: Size of transmit buffer
+ * @col_window: set_addr_win() honors the column range (xs/xe), so partial
+ *              lines can be updated
+ * @big_endian: write_vmem() supports big endian video memory
+ * @reg_speed_hz: SPI clock for register writes, 0 is the device speed
+ * @pixel_speed_hz: SPI clock for pixel data, 0 is the device speed
+ * @read_speed_hz: SPI clock for reads, 0 is 2 MHz
  * @init_sequence: Pointer to LCD initialization array
  * @gamma: String representation of Gamma curve(s)
  * @gamma_num: Number of Gamma curves
@@ -137,6 +223,11 @@ struct fbtft_display {
 	unsigned bpp;
 	unsigned fps;
 	int txbuflen;
+	bool col_window;
+	bool big_endian;
+	u32 reg_speed_hz;
+	u32 pixel_speed_hz;
+	u32 read_speed_hz;
 	int *init_sequence;
 	char *gamma;
 	int gamma_num;
@@ -154,6 +245,11 @@ struct fbtft_display {
  * @txbuflen: Size of transmit buffer
  * @startbyte: When set, enables use of Startbyte in transfers
  * @gamma: String representation of Gamma curve(s)
+ * @rt_priority: SCHED_FIFO priority of the update thread, 0 is SCHED_NORMAL
+ * @cpu_affinity: Bitmask of CPUs the update thread can run on, 0 is any
+ * @leading_edge: Send the first damage after idle without waiting a period
+ * @max_transfer: Largest SPI transfer the controller takes, 0 is no limit
+ * @big_endian: Video memory holds big endian RGB565, sent without byteswapping
  * @extra: A way to pass extra info
  */
 struct fbtft_platform_data {
@@ -165,6 +261,11 @@ struct fbtft_platform_data {
 	int txbuflen;
 	u8 startbyte;
 	char *gamma;
+	unsigned rt_priority;
+	unsigned long cpu_affinity;
+	bool leading_edge;
+	unsigned max_transfer;
+	bool big_endian;
 	void *extra;
 };
 
@@ -183,15 +284,82 @@ struct fbtft_platform_data {
  * @pdata: Pointer to platform data
  * @ssbuf: Not used
  * @pseudo_palette: Used by fb_set_colreg()
+ * @vmem: Video memory write_vmem() reads from, info->screen_base,
+ *        the snapshot buffer or the shadow buffer
+ * @vmem_dma: DMA address of info->screen_base if it is physically contiguous
+ * @gather: @txbuf.len bytes to collect the lines of a partial width window,
+ *          so they can be written together instead of line by line
  * @txbuf.buf: Transmit buffer
+ * @txbuf.dma: DMA address of the transmit buffer
  * @txbuf.len: Transmit buffer length
+ * @txbuf.streaming: Cached buffer, synced for the device before each write
+ *                   and back for the CPU after it
+ * @txbuf.chunk: Bytes of video memory sent per transfer, whole lines
+ *               when they fit
+ * @max_transfer: Largest SPI transfer the controller takes, 0 is no limit
+ * @speed_hz.reg: SPI clock for writes from @buf, 0 is the device speed
+ * @speed_hz.pixel: SPI clock for all other writes, 0 is the device speed
+ * @speed_hz.read: SPI clock for reads
+ * @autotune.num: Number of chunk sizes timed at probe
+ * @autotune.best: Index of the chunk size in use
+ * @autotune.chunk: Chunk sizes timed
+ * @autotune.us: Fastest full frame update in microseconds for each chunk size
+ * @pipeline.enabled: Convert into one txbuf slot while another is sent
+ * @pipeline.t: SPI transfer for each slot
+ * @pipeline.m: SPI message for each slot
+ * @pipeline.done: Completed when the slot's message has been sent
+ * @pipeline.pending: Slot has a message in flight
+ * @frame_msg.m: SPI message reused for full frame and txbuf chunk writes
+ * @frame_msg.t: Transfers of @frame_msg.m, at most @max_transfer each
+ * @frame_msg.num_t: Number of transfers allocated
+ * @frame_msg.buf: Buffer @frame_msg.m was built for
+ * @frame_msg.len: Length @frame_msg.m was built for
+ * @frame_msg.speed_hz: SPI clock @frame_msg.m was built for
+ * @frame_msg.chunk: @txbuf.chunk when @frame_msg.m was built
+ * @convert.band: Bands converted in parallel by fbtft_convert_vmem16()
+ * @convert.bands: Number of CPUs used for conversion, 1 disables it
  * @buf: Small buffer used when writing init data over SPI
  * @startbyte: Used by some controllers when in SPI mode.
  *             Format: 6 bit Device id + RS bit + RW bit
  * @fbtftops: FBTFT operations provided by driver or device (platform_data)
- * @dirty_lock: Protects dirty_lines_start and dirty_lines_end
- * @dirty_lines_start: Where to begin updating display
- * @dirty_lines_end: Where to end updating display
+ * @dirty.tiles: Bitmap of dirty tiles, set lock-free by mkdirty()
+ * @dirty.pending: Tiles taken over by the deferred io worker
+ * @dirty.open: Tile spans being merged into rectangles (worker only)
+ * @dirty.next: Tile spans for the current tile row (worker only)
+ * @dirty.cols: Number of tile columns
+ * @dirty.rows: Number of tile rows
+ * @col_window: Only send the dirty columns, set_addr_win() supports it
+ * @big_endian: Video memory is big endian RGB565 and is sent as is
+ * @shadow.buf: Copy of the video memory last sent to the display
+ * @shadow.enabled: Drop dirty tiles that match the shadow copy
+ * @shadow.sync: Refresh the shadow copy and do a full update
+ * @shadow.bytes_saved: Bytes not sent because they were unchanged
+ * @shadow.tiles_skipped: Number of unchanged tiles not sent
+ * @snapshot.buf: Stable copy of the video memory used during updates
+ * @snapshot.enabled: Copy the dirty tiles before updating the display
+ * @worker.kworker: Per display worker doing the display updates
+ * @worker.work: Work item that sends the dirty tiles
+ * @worker.task: Thread running @worker.kworker
+ * @worker.rt_priority: SCHED_FIFO priority, 0 is SCHED_NORMAL
+ * @worker.cpu_affinity: Bitmask of allowed CPUs, 0 is any
+ * @frame.lock: Protects the frame clock (@frame.epoch, @frame.period,
+ *              @frame.busy, @frame.last_update) and serializes arming
+ *              @frame.timer with stopping the worker
+ * @frame.timer: Fires on the next frame boundary to start an update
+ * @frame.epoch: Frame clock origin, updates are aligned to it
+ * @frame.period: Current frame period in nanoseconds
+ * @frame.fps: Requested frames per second
+ * @frame.min_fps: Lowest frame rate the period can be stretched to
+ * @frame.max_fps: Highest frame rate
+ * @frame.policy: Bus duty cycle policy, see enum fbtft_frame_policy
+ * @frame.update_time: Average update duration in nanoseconds
+ * @frame.updates: Number of updates sent
+ * @frame.coalesced: Damage merged into an already scheduled update
+ * @frame.dropped: Frame boundaries missed because an update overran
+ * @frame.leading_edge: Flush the first damage after idle immediately
+ * @frame.busy: An update is in progress
+ * @frame.last_update: When the last update finished (or was started
+ *                     on the leading edge)
  * @gpio.reset: GPIO used to reset display
  * @gpio.dc: Data/Command signal, also known as RS
  * @gpio.rd: Read latching signal
@@ -201,6 +369,11 @@ struct fbtft_platform_data {
  * @gpio.db[16]: Parallel databus
  * @gpio.led[16]: Led control signals
  * @gpio.aux[16]: Auxillary signals, not used by core
+ * @pbus.db[16]: Parallel databus descriptors, looked up once at register
+ * @pbus.wr: Write latching signal descriptor
+ * @pbus.latch: Bus latch signal descriptor
+ * @pbus.prev: Last value put on the databus
+ * @pbus.valid: @pbus.prev reflects the state of the data lines
  * @init_sequence: Pointer to LCD initialization array
  * @gamma.lock: Mutex for Gamma curve locking
  * @gamma.curves: Pointer to Gamma curve array
@@ -220,17 +393,96 @@ struct fbtft_par {
 	struct fbtft_platform_data *pdata;
 	u16 *ssbuf;
 	u32 pseudo_palette[16];
+	u8 *vmem;
+	dma_addr_t vmem_dma;
+	u8 *gather;
 	struct {
 		void *buf;
 		dma_addr_t dma;
 		size_t len;
+		bool streaming;
+		size_t chunk;
 	} txbuf;
+	size_t max_transfer;
+	struct {
+		u32 reg;
+		u32 pixel;
+		u32 read;
+	} speed_hz;
+	struct {
+		unsigned num;
+		unsigned best;
+		size_t chunk[FBTFT_AUTOTUNE_STEPS];
+		u32 us[FBTFT_AUTOTUNE_STEPS];
+	} autotune;
+	struct {
+		bool enabled;
+		struct spi_transfer t[FBTFT_TX_SLOTS];
+		struct spi_message m[FBTFT_TX_SLOTS];
+		struct completion done[FBTFT_TX_SLOTS];
+		bool pending[FBTFT_TX_SLOTS];
+	} pipeline;
+	struct {
+		struct spi_message m;
+		struct spi_transfer *t;
+		unsigned num_t;
+		void *buf;
+		size_t len;
+		u32 speed_hz;
+		size_t chunk;
+	} frame_msg;
+	struct {
+		struct fbtft_convert_band band[FBTFT_CONVERT_BANDS];
+		unsigned bands;
+	} convert;
 	u8 *buf;
 	u8 startbyte;
 	struct fbtft_ops fbtftops;
-	spinlock_t dirty_lock;
-	unsigned dirty_lines_start;
-	unsigned dirty_lines_end;
+	struct {
+		unsigned long *tiles;
+		unsigned long *pending;
+		struct fbtft_tile_span *open;
+		struct fbtft_tile_span *next;
+		unsigned cols;
+		unsigned rows;
+	} dirty;
+	bool col_window;
+	bool big_endian;
+	struct {
+		u8 *buf;
+		bool enabled;
+		bool sync;
+		unsigned long long bytes_saved;
+		unsigned long tiles_skipped;
+	} shadow;
+	struct {
+		u8 *buf;
+		bool enabled;
+	} snapshot;
+	struct {
+		struct kthread_worker kworker;
+		struct kthread_work work;
+		struct task_struct *task;
+		unsigned rt_priority;
+		unsigned long cpu_affinity;
+	} worker;
+	struct {
+		spinlock_t lock;
+		struct hrtimer timer;
+		ktime_t epoch;
+		u64 period;
+		unsigned fps;
+		unsigned min_fps;
+		unsigned max_fps;
+		enum fbtft_frame_policy policy;
+		u64 update_time;
+		unsigned long updates;
+		unsigned long coalesced;
+		unsigned long dropped;
+		bool leading_edge;
+		bool busy;
+		ktime_t last_update;
+	} frame;
 	struct {
 		int reset;
 		int dc;
@@ -242,6 +494,13 @@ struct fbtft_par {
 		int led[16];
 		int aux[16];
 	} gpio;
+	struct {
+		struct gpio_desc *db[16];
+		struct gpio_desc *wr;
+		struct gpio_desc *latch;
+		unsigned prev;
+		bool valid;
+	} pbus;
 	int *init_sequence;
 	struct {
 		struct mutex lock;
@@ -274,21 +533,36 @@ extern int fbtft_unregister_framebuffer(struct fb_info *fb_info);
 extern void fbtft_register_backlight(struct fbtft_par *par);
 extern void fbtft_unregister_backlight(struct fbtft_par *par);
 extern int fbtft_init_display(struct fbtft_par *par);
+extern int fbtft_worker_set_sched(struct fbtft_par *par);
 extern int fbtft_probe_common(struct fbtft_display *display,
 	struct spi_device *sdev, struct platform_device *pdev);
 extern int fbtft_remove_common(struct device *dev, struct fb_info *info);
 
 /* fbtft-io.c */
 extern int fbtft_write_spi(struct fbtft_par *par, void *buf, size_t len);
+extern int fbtft_write_spi_async(struct fbtft_par *par, unsigned slot,
+	void *buf, size_t len);
+extern int fbtft_write_spi_wait(struct fbtft_par *par, unsigned slot);
 extern int fbtft_write_spi_emulate_9(struct fbtft_par *par,
 	void *buf, size_t len);
 extern int fbtft_read_spi(struct fbtft_par *par, void *buf, size_t len);
 extern int fbtft_write_gpio8_wr(struct fbtft_par *par, void *buf, size_t len);
 extern int fbtft_write_gpio16_wr(struct fbtft_par *par, void *buf, size_t len);
+extern void fbtft_gpio_bus_init(struct fbtft_par *par);
+extern unsigned fbtft_gpio_bus_set(struct fbtft_par *par, unsigned data,
+	unsigned mask);
 extern int fbtft_write_gpio16_wr_latched(struct fbtft_par *par,
 	void *buf, size_t len);
 
 /* fbtft-bus.c */
+extern void fbtft_convert_vmem16(struct fbtft_par *par, void *dst,
+					const u16 *src, size_t count);
+extern void fbtft_convert_init(struct fbtft_par *par, unsigned bands);
+extern size_t fbtft_pack9(u8 *dst, const u16 *src, size_t count);
+extern size_t fbtft_convert_bus9(struct fbtft_par *par, u8 *dst,
+					const u8 *src, size_t len);
+extern void fbtft_pack_page(u8 *dst, size_t dst_stride, const u16 *src,
+	size_t src_stride, unsigned width, u16 threshold, bool invert);
 extern int fbtft_write_vmem8_bus8(struct fbtft_par *par, size_t offset, size_t len);
 extern int fbtft_write_vmem16_bus16(struct fbtft_par *par, size_t offset, size_t len);
 extern int fbtft_write_vmem16_bus8(struct fbtft_par *par, size_t offset, size_t len);
@@ -54,6 +54,18 @@ static unsigned speed;
 module_param(speed, uint, 0);
 MODULE_PARM_DESC(speed, "SPI speed (override device default)");
 
+static unsigned regspeed;
+module_param(regspeed, uint, 0);
+MODULE_PARM_DESC(regspeed, "SPI speed for register writes (default: speed)");
+
+static unsigned pixelspeed;
+module_param(pixelspeed, uint, 0);
+MODULE_PARM_DESC(pixelspeed, "SPI speed for pixel data (default: speed)");
+
+static unsigned readspeed;
+module_param(readspeed, uint, 0);
+MODULE_PARM_DESC(readspeed, "SPI speed for reads (override driver default)");
+
 static int mode = -1;
 module_param(mode, int, 0);
 MODULE_PARM_DESC(mode, "SPI mode (override device default)");
@@ -1097,7 +1109,7 @@ static int write_gpio16_wr_slow(struct fbtft_par *par, void *buf, size_t len)
 	u16 data;
 	int i;
 #ifndef DO_NOT_OPTIMIZE_FBTFT_WRITE_GPIO
-	static u16 prev_data;
+	u16 prev_data;
 #endif
 
 	fbtft_par_dbg_hex(DEBUG_WRITE, par, par->info->device, u8, buf, len,
@@ -1111,11 +1123,13 @@ static int write_gpio16_wr_slow(struct fbtft_par *par, void *buf, size_t len)
 
 		/* Set data */
 #ifndef DO_NOT_OPTIMIZE_FBTFT_WRITE_GPIO
-		if (data == prev_data) {
+		prev_data = par->pbus.prev;
+		if (par->pbus.valid && data == prev_data) {
 			gpio_set_value(par->gpio.wr, 0); /* used as delay */
 		} else {
 			for (i = 0; i < 16; i++) {
-				if ((data & 1) != (prev_data & 1))
+				if (!par->pbus.valid ||
+				    (data & 1) != (prev_data & 1))
 					gpio_set_value(par->gpio.db[i],
 								(data & 1));
 				data >>= 1;
@@ -1133,7 +1147,8 @@ static int write_gpio16_wr_slow(struct fbtft_par *par, void *buf, size_t len)
 		gpio_set_value(par->gpio.wr, 1);
 
 #ifndef DO_NOT_OPTIMIZE_FBTFT_WRITE_GPIO
-		prev_data = *(u16 *) buf;
+		par->pbus.prev = *(u16 *) buf;
+		par->pbus.valid = true;
 #endif
 		buf += 2;
 		len -= 2;
@@ -1378,6 +1393,12 @@ static int __init fbtft_device_init(void)
 				pdata->fps = fps;
 			if (txbuflen)
 				pdata->txbuflen = txbuflen;
+			if (regspeed)
+				pdata->display.reg_speed_hz = regspeed;
+			if (pixelspeed)
+				pdata->display.pixel_speed_hz = pixelspeed;
+			if (readspeed)
+				pdata->display.read_speed_hz = readspeed;
 			if (init_num)
 				pdata->display.init_sequence = init;
 			if (gpio)
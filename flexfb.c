@@ -481,6 +481,7 @@ static int flexfb_probe_common(struct spi_device *sdev, struct platform_device *
 		break;
 	case 3:
 		par->fbtftops.set_addr_win = set_addr_win_3;
+		par->col_window = true;
 		break;
 	default:
 		dev_err(dev, "argument 'setaddrwin': unknown value %d.\n", setaddrwin);